@@ -2,17 +2,37 @@
 #pragma once
 #include <QObject>
 #include <QFuture>
+#include <QPromise>
 #include <QMetaMethod>
 #include <QPointer>
 #include <QThread>
 #include <QFutureWatcher>
 #include <QCoreApplication>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QDeadlineTimer>
+#include <QSet>
+#include <QHash>
+#include <QCache>
 #include <functional>
-#include <QRegularExpression>
+#include <QReadWriteLock>
+#include <QThreadStorage>
 #include <QVariant>
+#include <QDebug>
 #include <QTimer>
+#include <QThreadPool>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <chrono>
 #include <type_traits>
+#include <utility>
+#include <tuple>
+#include <any>
+#include <optional>
 
 #define ASYNCFUTURE_ERROR_OBSERVE_VOID_WITH_ARGUMENT "Observe a QFuture<void> but your callback contains an input argument"
 #define ASYNCFUTURE_ERROR_CALLBACK_NO_MORE_ONE_ARGUMENT "Callback function should not take more than 1 argument"
@@ -46,6 +66,49 @@ enum class CancelPropagation {
     Blocked
 };
 
+/* Controls how observe(object, signal) delivers the signal to its future.
+ * Queued always waits for an event loop turn of the observing thread.
+ * Direct completes the future in the emitting call stack, on the emitter's thread.
+ * Auto is direct if the signal is emitted on the observing thread, otherwise queued.
+ */
+enum class ConnectionPolicy {
+    Queued,
+    Direct,
+    Auto
+};
+
+/* Controls what a signal stream does when its buffer of results that
+ * are not yet delivered is full.
+ * DropOldest discards the oldest pending result.
+ * Block blocks the emitting thread until the results are delivered.
+ * Coalesce replaces the newest pending result with the new one.
+ */
+enum class OverflowPolicy {
+    DropOldest,
+    Block,
+    Coalesce
+};
+
+/* How waitForFinished() waits. EventLoop runs a nested event loop, so
+ * queued signals keep being delivered while waiting. Blocking parks the
+ * calling thread without an event loop, for worker threads.
+ */
+enum class WaitMode {
+    EventLoop,
+    Blocking
+};
+
+/* The priority of a chain, set by Observable::priority(). A High stage is
+ * dispatched on the context's thread ahead of the posted events that are
+ * still waiting, and a Low stage after them. Normal keeps the plain order.
+ * run(executor, callback) stages start at the matching thread pool priority.
+ */
+enum class Priority {
+    Low,
+    Normal,
+    High
+};
+
 namespace Private {
 
 /* Begin traits functions */
@@ -155,11 +218,46 @@ struct signal_traits {
 template <typename R, typename C>
 struct signal_traits<R (C::*)()> {
     typedef void result_type;
+    typedef C object_type;
 };
 
 template <typename R, typename C, typename ARG0>
 struct signal_traits<R (C::*)(ARG0)> {
     typedef typename std::decay<ARG0>::type result_type;
+    typedef C object_type;
+};
+
+// A signal with more than one argument is observed as a std::tuple of its arguments
+template <typename R, typename C, typename ARG0, typename ARG1, typename ...ARGS>
+struct signal_traits<R (C::*)(ARG0, ARG1, ARGS...)> {
+    typedef std::tuple<typename std::decay<ARG0>::type,
+                       typename std::decay<ARG1>::type,
+                       typename std::decay<ARGS>::type...> result_type;
+    typedef C object_type;
+};
+
+template <typename T>
+struct signal_tuple_traits {
+    enum {
+        is_tuple = false
+    };
+};
+
+template <typename ...ARGS>
+struct signal_tuple_traits<std::tuple<ARGS...>> {
+    enum {
+        is_tuple = true
+    };
+
+    typedef std::tuple<ARGS...> tuple_type;
+
+    /// A functor to connect the signal to, which forwards the arguments as a tuple
+    template <typename Emitter>
+    static auto functor(Emitter emitter) {
+        return [emitter](const ARGS& ...args) {
+            emitter(tuple_type(args...));
+        };
+    }
 };
 
 template <typename T>
@@ -311,7 +409,7 @@ public:
     Value() {
     }
 
-    Value(R&& v) : value(v){
+    Value(R&& v) : value(std::move(v)){
     }
 
     Value(R* v) : value(*v) {
@@ -346,6 +444,144 @@ void runInMainThread(F func) {
                      QCoreApplication::instance(), std::move(func), Qt::QueuedConnection);
 }
 
+/// Run func on the thread of the context object. It is called immediately if
+/// the current thread is the context's thread, otherwise it is queued. Nothing
+/// is run if the context object is destroyed.
+template <typename F>
+void runOnContext(QPointer<QObject> context, F func) {
+    if (context.isNull()) {
+        return;
+    }
+
+    if (QThread::currentThread() == context->thread()) {
+        func();
+        return;
+    }
+
+    QMetaObject::invokeMethod(context.data(), [context, func]() mutable {
+        if (!context.isNull()) {
+            func();
+        }
+    }, Qt::QueuedConnection);
+}
+
+/* PostTarget posts functions to an object from any thread, e.g. from the
+ * TimerService thread, where reading a QPointer would race with the
+ * object's destruction. It is closed when the object is destroyed or by
+ * close(), and a function is posted under the lock, so the object can't be
+ * deleted in the middle of a post.
+ */
+class PostTarget {
+public:
+    static std::shared_ptr<PostTarget> create(QObject* object) {
+        auto target = std::make_shared<PostTarget>();
+        target->object = object;
+        if (object) {
+            std::weak_ptr<PostTarget> weakTarget = target;
+            target->connection = QObject::connect(object, &QObject::destroyed, [weakTarget]() {
+                auto strongTarget = weakTarget.lock();
+                if (strongTarget) {
+                    strongTarget->close();
+                }
+            });
+        }
+        return target;
+    }
+
+    ~PostTarget() {
+        QObject::disconnect(connection);
+    }
+
+    /// Queue func to the object's thread. Returns false if it is closed.
+    template <typename F>
+    bool post(F func) {
+        QMutexLocker locker(&mutex);
+        if (object == nullptr) {
+            return false;
+        }
+        QMetaObject::invokeMethod(object, std::move(func), Qt::QueuedConnection);
+        return true;
+    }
+
+    void close() {
+        QMutexLocker locker(&mutex);
+        object = nullptr;
+    }
+
+private:
+    QMutex mutex;
+    QObject* object = nullptr;
+    QMetaObject::Connection connection;
+};
+
+inline int threadPoolPriority(Priority priority) {
+    switch (priority) {
+    case Priority::Low:
+        return -1;
+    case Priority::High:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/// An object living in the current thread, to receive the connections that
+/// are delivered to it. There is one per thread, owned by a QThreadStorage.
+inline QObject* threadContext() {
+    static QThreadStorage<QObject*> contexts;
+    if (!contexts.hasLocalData()) {
+        contexts.setLocalData(new QObject());
+    }
+    return contexts.localData();
+}
+
+/// Runs functions posted with an event priority on the thread it lives in.
+/// There is one per thread, owned by a QThreadStorage.
+class PriorityDispatcher : public QObject {
+public:
+    /// Run func on the current thread, ordered by priority against the other posted events
+    static void post(const QObject* contextObject, Priority priority, std::function<void()> func) {
+        static QThreadStorage<PriorityDispatcher*> dispatchers;
+        if (!dispatchers.hasLocalData()) {
+            dispatchers.setLocalData(new PriorityDispatcher());
+        }
+
+        const Qt::EventPriority eventPriority = priority == Priority::High ? Qt::HighEventPriority :
+                                                priority == Priority::Low ? Qt::LowEventPriority :
+                                                                            Qt::NormalEventPriority;
+
+        QCoreApplication::postEvent(dispatchers.localData(), new Task(contextObject, std::move(func)), eventPriority);
+    }
+
+protected:
+    bool event(QEvent* event) override {
+        if (event->type() != eventType()) {
+            return QObject::event(event);
+        }
+        Task* task = static_cast<Task*>(event);
+        if (!task->context.isNull()) {
+            task->func();
+        }
+        return true;
+    }
+
+private:
+    class Task : public QEvent {
+    public:
+        Task(const QObject* context, std::function<void()> func) :
+            QEvent(QEvent::Type(eventType())), context(context), func(std::move(func)) {
+        }
+
+        QPointer<const QObject> context;
+        std::function<void()> func;
+    };
+
+    static int eventType() {
+        static const int type = QEvent::registerEventType();
+        return type;
+    }
+};
+
 /*
  * @param owner If the object is destroyed, it should destroy the watcher
  * @param contextObject Determine the receiver callback
@@ -466,6 +702,411 @@ void watch(QFuture<T> future,
     watcher->setFuture(future);
 }
 
+/* TimerService runs callbacks at their deadlines on a single service thread,
+ * shared by every timeout in the library instead of a QTimer per timeout.
+ * It works from any thread and doesn't need an event loop.
+ *
+ * Timers are kept in a hierarchical timer wheel with a 1ms tick: 4 levels
+ * of 64 slots, each slot a linked list of nodes, so arm() and disarm() are
+ * O(1). A timer beyond the range of the top level (about 4.6 hours) waits
+ * in its last slot and is placed again when that slot is cascaded. Nodes
+ * live in a pool and are reused, and a TimerId carries the node index and
+ * its generation, so a disarm() after the timer has fired is detected.
+ *
+ * Callbacks are executed on the service thread without holding the lock,
+ * so they should be short. disarm() returns false if the callback has
+ * already been fired (or is firing).
+ */
+class TimerService {
+public:
+    typedef quint64 TimerId;
+
+    static TimerService* instance() {
+        static TimerService service;
+        return &service;
+    }
+
+    TimerId arm(QDeadlineTimer deadline, std::function<void()> callback) {
+        const qint64 expiry = deadline.isForever() ? std::numeric_limits<qint64>::max() : toTick(deadline.deadlineNSecs());
+
+        QMutexLocker locker(&mutex);
+        if (armedCount == 0) {
+            // Nothing to cascade, skip the idle time
+            currentTick = qMax(currentTick, currentTickNow());
+        }
+        const qint32 index = allocate();
+        Node& node = nodes[index];
+        node.callback = std::move(callback);
+        node.expiry = qMax(expiry, currentTick);
+        insert(index);
+        armedCount++;
+
+        if (node.expiry < wakeTick) {
+            // The earliest deadline is changed
+            condition.wakeOne();
+        }
+        return (TimerId(node.generation) << 32) | quint32(index);
+    }
+
+    bool disarm(TimerId id) {
+        const qint32 index = qint32(id & 0xffffffffu);
+        const quint32 generation = quint32(id >> 32);
+
+        QMutexLocker locker(&mutex);
+        if (index < 0 || index >= qint32(nodes.size()) || generation == 0 || nodes[index].generation != generation ||
+            nodes[index].level < 0) {
+            return false;
+        }
+        unlink(index);
+        release(index);
+        armedCount--;
+        return true;
+    }
+
+    /// The number of armed timers
+    int count() {
+        QMutexLocker locker(&mutex);
+        return armedCount;
+    }
+
+    ~TimerService() {
+        mutex.lock();
+        stopping = true;
+        condition.wakeOne();
+        mutex.unlock();
+
+        thread->wait();
+        delete thread;
+    }
+
+private:
+    static constexpr int LevelCount = 4;
+    static constexpr int SlotBits = 6;
+    static constexpr int SlotCount = 1 << SlotBits;
+    static constexpr qint64 TickNSecs = 1000 * 1000;
+
+    class Node {
+    public:
+        std::function<void()> callback;
+        qint64 expiry = 0;
+        qint32 prev = -1;
+        qint32 next = -1;
+        quint32 generation = 1;
+        qint8 level = -1;
+        quint8 slot = 0;
+    };
+
+    QMutex mutex;
+    QWaitCondition condition;
+    std::vector<Node> nodes;
+    qint32 freeList = -1;
+    qint32 heads[LevelCount][SlotCount];
+    quint64 occupied[LevelCount] = {};
+    qint64 currentTick;
+    qint64 wakeTick = std::numeric_limits<qint64>::max();
+    int armedCount = 0;
+    bool stopping = false;
+    QThread* thread;
+
+    TimerService() {
+        for (auto& level : heads) {
+            std::fill(std::begin(level), std::end(level), -1);
+        }
+        currentTick = currentTickNow();
+
+        thread = QThread::create([this]() {
+            run();
+        });
+        thread->setObjectName(QStringLiteral("AsyncFuture::TimerService"));
+        thread->start();
+    }
+
+    // Round up, so a timer never fires before its deadline
+    static qint64 toTick(qint64 nsecs) {
+        return nsecs / TickNSecs + (nsecs % TickNSecs > 0 ? 1 : 0);
+    }
+
+    // The last tick that has started
+    static qint64 currentTickNow() {
+        return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs() / TickNSecs;
+    }
+
+    qint32 allocate() {
+        if (freeList >= 0) {
+            const qint32 index = freeList;
+            freeList = nodes[index].next;
+            nodes[index].next = -1;
+            return index;
+        }
+        nodes.emplace_back();
+        return qint32(nodes.size() - 1);
+    }
+
+    void release(qint32 index) {
+        Node& node = nodes[index];
+        node.callback = nullptr;
+        node.level = -1;
+        node.prev = -1;
+        node.generation = node.generation == std::numeric_limits<quint32>::max() ? 1 : node.generation + 1;
+        node.next = freeList;
+        freeList = index;
+    }
+
+    void insert(qint32 index) {
+        Node& node = nodes[index];
+        const qint64 delta = node.expiry - currentTick;
+
+        int level = 0;
+        qint64 tick = node.expiry;
+        while (level < LevelCount - 1 && delta >= (qint64(1) << (SlotBits * (level + 1)))) {
+            level++;
+        }
+        if (level == LevelCount - 1 && delta >= (qint64(1) << (SlotBits * LevelCount))) {
+            // Beyond the range. It is placed again when the last slot is cascaded.
+            tick = currentTick + (qint64(1) << (SlotBits * LevelCount)) - 1;
+        }
+
+        const int slot = int((tick >> (SlotBits * level)) & (SlotCount - 1));
+        node.level = qint8(level);
+        node.slot = quint8(slot);
+        node.prev = -1;
+        node.next = heads[level][slot];
+        if (node.next >= 0) {
+            nodes[node.next].prev = index;
+        }
+        heads[level][slot] = index;
+        occupied[level] |= quint64(1) << slot;
+    }
+
+    void unlink(qint32 index) {
+        Node& node = nodes[index];
+        if (node.prev >= 0) {
+            nodes[node.prev].next = node.next;
+        } else {
+            heads[node.level][node.slot] = node.next;
+            if (node.next < 0) {
+                occupied[node.level] &= ~(quint64(1) << node.slot);
+            }
+        }
+        if (node.next >= 0) {
+            nodes[node.next].prev = node.prev;
+        }
+        node.prev = -1;
+        node.next = -1;
+    }
+
+    // Take the list of a slot
+    qint32 takeSlot(int level, int slot) {
+        const qint32 head = heads[level][slot];
+        heads[level][slot] = -1;
+        occupied[level] &= ~(quint64(1) << slot);
+        return head;
+    }
+
+    // The first tick >= currentTick that has something to do: a level 0 slot
+    // to expire, or a slot of an upper level to cascade.
+    qint64 nextEventTick() const {
+        qint64 result = std::numeric_limits<qint64>::max();
+        for (int level = 0 ; level < LevelCount ; level++) {
+            if (occupied[level] == 0) {
+                continue;
+            }
+            const int shift = SlotBits * level;
+            // The first block of an upper level that starts at or after currentTick. A block that
+            // starts before it has been cascaded already, but currentTick may sit on the start of
+            // a block that is not cascaded yet (after an early wake or the last tick of a block).
+            const qint64 base = level == 0 ? currentTick : (currentTick + (qint64(1) << shift) - 1) >> shift;
+            const int rotate = int(base & (SlotCount - 1));
+            const quint64 mask = rotate == 0 ? occupied[level] : (occupied[level] >> rotate) | (occupied[level] << (SlotCount - rotate));
+            const qint64 tick = (base + qCountTrailingZeroBits(mask)) << shift;
+            result = qMin(result, tick);
+        }
+        return result;
+    }
+
+    // Process the ticks up to now and collect the expired callbacks
+    void advance(qint64 now, std::vector<std::function<void()>>& expired) {
+        while (currentTick <= now) {
+            const qint64 next = nextEventTick();
+            if (next > now) {
+                currentTick = now + 1;
+                return;
+            }
+            currentTick = next;
+
+            // Cascade the upper levels whose slot starts at this tick
+            for (int level = 1 ; level < LevelCount ; level++) {
+                const int shift = SlotBits * level;
+                if ((currentTick & ((qint64(1) << shift) - 1)) != 0) {
+                    break;
+                }
+                qint32 index = takeSlot(level, int((currentTick >> shift) & (SlotCount - 1)));
+                while (index >= 0) {
+                    const qint32 following = nodes[index].next;
+                    insert(index);
+                    index = following;
+                }
+            }
+
+            qint32 index = takeSlot(0, int(currentTick & (SlotCount - 1)));
+            while (index >= 0) {
+                const qint32 following = nodes[index].next;
+                expired.push_back(std::move(nodes[index].callback));
+                release(index);
+                armedCount--;
+                index = following;
+            }
+            currentTick++;
+        }
+    }
+
+    void run() {
+        std::vector<std::function<void()>> expired;
+
+        QMutexLocker locker(&mutex);
+        while (!stopping) {
+            const qint64 nowNSecs = QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+            advance(nowNSecs / TickNSecs, expired);
+
+            if (!expired.empty()) {
+                locker.unlock();
+                for (auto& callback : expired) {
+                    callback();
+                }
+                expired.clear();
+                locker.relock();
+                continue;
+            }
+
+            wakeTick = nextEventTick();
+            if (wakeTick == std::numeric_limits<qint64>::max()) {
+                condition.wait(&mutex);
+            } else {
+                const qint64 nsecs = wakeTick * TickNSecs - nowNSecs;
+                condition.wait(&mutex, QDeadlineTimer(std::chrono::nanoseconds(qMax<qint64>(nsecs, 0)), Qt::PreciseTimer));
+            }
+            wakeTick = std::numeric_limits<qint64>::max();
+        }
+    }
+};
+
+/* Report the ticks of an interval() future. Each tick arms the next one
+ * from the timer thread, and the deadlines are counted from the origin so
+ * the ticks don't drift.
+ */
+inline void armIntervalTick(QFutureInterface<int> fi, QDeadlineTimer origin, int msec, int index, int count) {
+    const QDeadlineTimer deadline = QDeadlineTimer::addNSecs(origin, qint64(index + 1) * msec * 1000 * 1000);
+
+    TimerService::instance()->arm(deadline, [fi, origin, msec, index, count]() mutable {
+        if (fi.isCanceled()) {
+            fi.reportFinished();
+            return;
+        }
+        fi.reportResult(index, index);
+        if (count >= 0 && index + 1 >= count) {
+            fi.reportFinished();
+            return;
+        }
+        armIntervalTick(fi, origin, msec, index + 1, count);
+    });
+}
+
+/* Returns a future that completes with the source, or is canceled at the
+ * deadline together with the source. The deadline is handled right on the
+ * TimerService thread. A QFutureWatcher on the source forwards its result
+ * and progress, and disarms the timer once the source is settled. Another
+ * one on the returned future pushes its cancellation to the source.
+ */
+template <typename T>
+QFuture<T> timeoutFuture(QFuture<T> source, QDeadlineTimer deadline) {
+    class State {
+    public:
+        QMutex mutex;
+        QFutureInterface<T> fi;
+        QAtomicInteger<quint64> timerId{0};
+    };
+
+    auto state = std::make_shared<State>();
+    state->fi.reportStarted();
+    QFuture<T> output = state->fi.future();
+
+    state->timerId.storeRelease(TimerService::instance()->arm(deadline, [state, source]() mutable {
+        {
+            QMutexLocker locker(&state->mutex);
+            if (!state->fi.isFinished()) {
+                state->fi.reportCanceled();
+                state->fi.reportFinished();
+            }
+        }
+        source.cancel();
+    }));
+
+    auto disarm = [state]() {
+        const quint64 timerId = state->timerId.fetchAndStoreOrdered(0);
+        if (timerId != 0) {
+            TimerService::instance()->disarm(timerId);
+        }
+    };
+
+    auto watcher = new QFutureWatcher<T>();
+    auto settle = [state, watcher, source, disarm]() {
+        watcher->disconnect();
+        watcher->deleteLater();
+        disarm();
+
+        QMutexLocker locker(&state->mutex);
+        if (state->fi.isFinished()) {
+            return;
+        }
+        if (source.isCanceled()) {
+            state->fi.reportCanceled();
+        } else if constexpr (!std::is_same<T, void>::value) {
+            if (source.resultCount() > 0) {
+                state->fi.reportResults(source.results());
+            }
+        }
+        state->fi.reportFinished();
+    };
+
+    QObject::connect(watcher, &QFutureWatcher<T>::finished, settle);
+    QObject::connect(watcher, &QFutureWatcher<T>::canceled, settle);
+    QObject::connect(watcher, &QFutureWatcher<T>::progressRangeChanged, [state](int minimum, int maximum) {
+        state->fi.setProgressRange(minimum, maximum);
+    });
+    QObject::connect(watcher, &QFutureWatcher<T>::progressValueChanged, [state](int value) {
+        state->fi.setProgressValue(value);
+    });
+
+    // Push the cancellation of the returned future to the source right away
+    auto outputWatcher = new QFutureWatcher<T>();
+    auto release = [state, outputWatcher, source, disarm]() mutable {
+        outputWatcher->disconnect();
+        outputWatcher->deleteLater();
+        if (!state->fi.isCanceled()) {
+            return;
+        }
+        disarm();
+        source.cancel();
+
+        QMutexLocker locker(&state->mutex);
+        if (!state->fi.isFinished()) {
+            state->fi.reportFinished();
+        }
+    };
+
+    QObject::connect(outputWatcher, &QFutureWatcher<T>::finished, release);
+    QObject::connect(outputWatcher, &QFutureWatcher<T>::canceled, release);
+
+    if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+        watcher->moveToThread(QCoreApplication::instance()->thread());
+        outputWatcher->moveToThread(QCoreApplication::instance()->thread());
+    }
+    watcher->setFuture(source);
+    outputWatcher->setFuture(output);
+
+    return output;
+}
+
 /* DeferredFuture implements a QFutureInterface that could complete/cancel a QFuture.
  *
  * 1) It is a private class that won't export to public
@@ -563,6 +1204,18 @@ public:
         QFutureInterface<T>::reportFinished();
     }
 
+    template <typename R>
+    void complete(QList<R>&& value) {
+        if (isFinished()) {
+            return;
+        }
+
+        reportResult(value);
+        // Release the caller's reference, the result store keeps its own
+        value = QList<R>();
+        QFutureInterface<T>::reportFinished();
+    }
+
     template <typename R>
     void complete(Value<R> value) {
         this->complete(value.value);
@@ -685,6 +1338,17 @@ public:
         return ptr;
     }
 
+    /// Create a DeferredFuture that adopts an existing future interface
+    static QSharedPointer<DeferredFuture<T> > create(const QFutureInterface<T>& fi) {
+        auto deleter = [](DeferredFuture<T> *object) {
+            object->cancel();
+            object->deleteLater();
+        };
+        QSharedPointer<DeferredFuture<T> > ptr(new DeferredFuture<T>(fi), deleter);
+        ptr->weakRef = ptr.toWeakRef();
+        return ptr;
+    }
+
     template <typename R>
     void reportResult(R& value, int index = -1) {
         QFutureInterface<T>::reportResult(value, index);
@@ -698,10 +1362,9 @@ public:
     void reportResult(QList<R>& value) {
         if constexpr (std::is_same_v<QList<R>, T>) {
             QFutureInterface<T>::reportResult(&value, -1); // Use -1 when T is QList
-        } else {
-            for (int i = 0; i < value.size(); ++i) {
-                QFutureInterface<T>::reportResult(value[i], i);
-            }
+        } else if (!value.isEmpty()) {
+            // One call for the whole list. The result store shares the list data.
+            QFutureInterface<T>::reportResults(value);
         }
     }
 
@@ -731,6 +1394,11 @@ protected:
             moveToThread(QCoreApplication::instance()->thread());
     }
 
+    DeferredFuture(const QFutureInterface<T>& fi): QObject(nullptr),
+                    QFutureInterface<T>(fi) {
+            moveToThread(QCoreApplication::instance()->thread());
+    }
+
     QMutex mutex;
 
 private:
@@ -803,26 +1471,175 @@ private:
 protected:
 };
 
-class CombinedFuture: public DeferredFuture<void> {
-
+/* LazyDeferredFuture is the shared data of a Deferred. It starts with a
+ * plain QFutureInterface, which is enough to complete or cancel the future.
+ * The DeferredFuture (a QObject with watchers and context links) adopting
+ * the same interface is only created when it is needed, e.g. to complete by
+ * another future or to track it.
+ *
+ * It replaces the QSharedPointer<DeferredFuture<T>> that Deferred used to
+ * hold as `deferredFuture`, so it keeps the parts of the QSharedPointer
+ * interface that subclasses of Deferred may use. They materialize the
+ * DeferredFuture.
+ */
+template <typename T>
+class LazyDeferredFuture {
 public:
-    CombinedFuture(bool settleAllModeArg = false) : DeferredFuture<void>(),
-        settledCount(0),
-        count(0),
-        anyCanceled(false),
-        settleAllMode(settleAllModeArg)
-    {
-        //Cancel all sub futures if this future is cancelled
-        Private::watch(
-                    future(),
-                    this,
-                    this,
-                    [](){},
-        [this](){
-            mutex.lock();
-            for(FutureInfo* info : futures) {
-                if(info->childFuture.isRunning() && !info->childFuture.isFinished()) {
-                    info->childFuture.cancel();
+    LazyDeferredFuture() : state(QSharedPointer<State>::create()) {
+    }
+
+    QFutureInterface<T>& interface() const {
+        return state->fi;
+    }
+
+    DeferredFuture<T>* operator->() const {
+        return materialize().data();
+    }
+
+    DeferredFuture<T>* data() const {
+        return materialize().data();
+    }
+
+    bool isMaterialized() const {
+        QMutexLocker locker(&state->mutex);
+        return !state->deferred.isNull();
+    }
+
+    DeferredFuture<T>& operator*() const {
+        return *materialize();
+    }
+
+    operator QSharedPointer<DeferredFuture<T>>() const {
+        return materialize();
+    }
+
+    QWeakPointer<DeferredFuture<T>> toWeakRef() const {
+        return materialize().toWeakRef();
+    }
+
+    bool isNull() const {
+        return false;
+    }
+
+    QSharedPointer<DeferredFuture<T>> materialize() const {
+        QMutexLocker locker(&state->mutex);
+        if (state->deferred.isNull()) {
+            state->deferred = DeferredFuture<T>::create(state->fi);
+        }
+        return state->deferred;
+    }
+
+    // complete()
+    void complete() {
+        state->disarmCancelTimer();
+        if (state->fi.isFinished()) {
+            return;
+        }
+        state->fi.reportFinished();
+    }
+
+    template <typename R>
+    void complete(const R& value) {
+        state->disarmCancelTimer();
+        if (state->fi.isFinished()) {
+            return;
+        }
+        state->fi.reportResult(value);
+        state->fi.reportFinished();
+    }
+
+    template <typename R>
+    void complete(QList<R>&& value) {
+        state->disarmCancelTimer();
+        if (state->fi.isFinished()) {
+            return;
+        }
+        if (!value.isEmpty()) {
+            state->fi.reportResults(value);
+        }
+        value = QList<R>();
+        state->fi.reportFinished();
+    }
+
+    void cancel() {
+        state->disarmCancelTimer();
+        if (state->fi.isFinished()) {
+            return;
+        }
+        state->fi.reportCanceled();
+        state->fi.reportFinished();
+    }
+
+    /// Cancel the future if it is not finished after msec. It replaces the previous one.
+    void cancelAfter(int msec) {
+        QWeakPointer<State> weakState = state;
+        const quint64 timerId = TimerService::instance()->arm(QDeadlineTimer(msec, Qt::PreciseTimer), [weakState]() {
+            auto strongState = weakState.toStrongRef();
+            if (strongState.isNull() || strongState->fi.isFinished()) {
+                return;
+            }
+            strongState->fi.reportCanceled();
+            strongState->fi.reportFinished();
+        });
+
+        const quint64 previous = state->cancelTimerId.fetchAndStoreOrdered(timerId);
+        if (previous != 0) {
+            TimerService::instance()->disarm(previous);
+        }
+    }
+
+private:
+    class State {
+    public:
+        QFutureInterface<T> fi{QFutureInterface<T>::Running};
+        QMutex mutex;
+        QSharedPointer<DeferredFuture<T>> deferred;
+        QAtomicInteger<quint64> cancelTimerId{0};
+
+        void disarmCancelTimer() {
+            if (cancelTimerId.loadRelaxed() == 0) {
+                return;
+            }
+            const quint64 id = cancelTimerId.fetchAndStoreOrdered(0);
+            if (id != 0) {
+                TimerService::instance()->disarm(id);
+            }
+        }
+
+        ~State() {
+            disarmCancelTimer();
+            // Auto cancellation. Once materialized, it is left to the deleter
+            // of the DeferredFuture, which may be kept alive by the futures it observes.
+            if (deferred.isNull() && !fi.isFinished()) {
+                fi.reportCanceled();
+                fi.reportFinished();
+            }
+        }
+    };
+
+    QSharedPointer<State> state;
+};
+
+class CombinedFuture: public DeferredFuture<void> {
+
+public:
+    CombinedFuture(bool settleAllModeArg = false) : DeferredFuture<void>(),
+        settledCount(0),
+        count(0),
+        anyCanceled(false),
+        settleAllMode(settleAllModeArg)
+    {
+        //Cancel all sub futures if this future is cancelled
+        Private::watch(
+                    future(),
+                    this,
+                    this,
+                    [](){},
+        [this](){
+            mutex.lock();
+            for(FutureInfo* info : futures) {
+                if(info->childFuture.isRunning() && !info->childFuture.isFinished()) {
+                    info->childFuture.cancel();
                 }
             }
             mutex.unlock();
@@ -834,12 +1651,18 @@ public:
 
     ~CombinedFuture() {
         for(auto progress : futures) {
+            if (progress->timerId != 0) {
+                TimerService::instance()->disarm(progress->timerId);
+            }
             delete progress;
         }
     }
 
+    /// Add a child future. If the deadline is not forever, the child will be
+    /// canceled and counted as canceled once the deadline expires. Otherwise,
+    /// the timeout set by setTimeout() is applied.
     template <typename T>
-    void addFuture(const QFuture<T> future) {
+    void addFuture(const QFuture<T> future, QDeadlineTimer deadline = QDeadlineTimer(QDeadlineTimer::Forever)) {
         if (isFinished()) {
             return;
         }
@@ -849,9 +1672,18 @@ public:
 
 
         auto info = new FutureInfo(QFuture<void>(future));
+        info->typedFuture = future;
         futures.append(info);
         Q_ASSERT(index == futures.size() - 1);
 
+        if (deadline.isForever() && timeout >= 0) {
+            deadline = QDeadlineTimer(timeout, Qt::PreciseTimer);
+        }
+
+        if (!deadline.isForever()) {
+            armDeadline(index, deadline);
+        }
+
         if(future.progressMaximum() > 0) {
             info->max = future.progressMaximum();
         }
@@ -890,6 +1722,57 @@ public:
         );
     }
 
+    /// Set a timeout (in milliseconds) for each child. It applies to the
+    /// children added afterwards and to the pending children, counting from
+    /// now.
+    void setTimeout(int msec) {
+        QMutexLocker locker(&mutex);
+        timeout = msec;
+
+        for (int i = 0 ; i < futures.size() ; i++) {
+            if (!futures[i]->settled) {
+                armDeadline(i, QDeadlineTimer(msec, Qt::PreciseTimer));
+            }
+        }
+    }
+
+    /// Register a callback that is invoked with the index of every child
+    /// future once it is completed or canceled. Children that have already
+    /// settled are replayed immediately. The callback runs on the thread that
+    /// settles the child (the main thread for watched futures).
+    void onSettled(std::function<void(int)> callback) {
+        QList<int> replay;
+        mutex.lock();
+        for (int i = 0 ; i < futures.size() ; i++) {
+            if (futures[i]->settled) {
+                replay << i;
+            }
+        }
+        settledCallbacks.append(callback);
+        mutex.unlock();
+
+        for (int index : replay) {
+            callback(index);
+        }
+    }
+
+    /// Obtain the child future at index with its original type. QFuture<void>
+    /// is always available. For other types, the type must match the one
+    /// that was added, otherwise an invalid future is returned.
+    template <typename T>
+    QFuture<T> futureAt(int index) {
+        QMutexLocker locker(&mutex);
+        Q_ASSERT(index >= 0 && index < futures.size());
+
+        if constexpr (std::is_same<T, void>::value) {
+            return futures[index]->childFuture;
+        } else {
+            const QFuture<T>* typed = std::any_cast<QFuture<T>>(&futures[index]->typedFuture);
+            Q_ASSERT_X(typed, "AsyncFuture::Combinator", "The type of the child future does not match");
+            return typed ? *typed : QFuture<T>();
+        }
+    }
+
     static QSharedPointer<CombinedFuture> create(bool settleAllMode) {
         auto deleter = [](CombinedFuture *object) {
             object->cancel();
@@ -910,54 +1793,130 @@ private:
 
         int max = 1;
         int value = 0;
+        bool settled = false;
+        TimerService::TimerId timerId = 0;
         QFuture<void> childFuture;
+
+        // The child future with its original type, i.e QFuture<T>
+        std::any typedFuture;
+    };
+
+    enum class Outcome {
+        Pending,
+        Completed,
+        Canceled
     };
 
     QWeakPointer<CombinedFuture> weakRef;
     int settledCount;
     int count;
     bool anyCanceled;
+    bool decided = false;
     bool settleAllMode;
+    int timeout = -1;
     QVector<FutureInfo*> futures;
+    QList<std::function<void(int)>> settledCallbacks;
 
-    void completeFutureAt(int index) {
-        Q_UNUSED(index);
+    // It should be called with mutex locked
+    void armDeadline(int index, QDeadlineTimer deadline) {
+        FutureInfo* info = futures[index];
+        if (info->timerId != 0) {
+            TimerService::instance()->disarm(info->timerId);
+        }
+
+        auto weakRef_ = weakRef;
+        info->timerId = TimerService::instance()->arm(deadline, [weakRef_, index]() {
+            auto self = weakRef_.toStrongRef();
+            if (!self.isNull()) {
+                self->expireFutureAt(index);
+            }
+        });
+    }
+
+    void expireFutureAt(int index) {
         mutex.lock();
-        settledCount++;
-        finishProgress(index);
+        FutureInfo* info = futures[index];
+        info->timerId = 0;
+        QFuture<void> child = info->childFuture;
+        bool settled = info->settled;
         mutex.unlock();
-        checkFulfilled();
+
+        if (settled) {
+            return;
+        }
+
+        if (child.isFinished() && !child.isCanceled()) {
+            // Finished just before the deadline. The watcher has not reported it yet.
+            completeFutureAt(index);
+            return;
+        }
+
+        child.cancel();
+        cancelFutureAt(index);
+    }
+
+    void completeFutureAt(int index) {
+        settleFutureAt(index, false);
     }
 
     void cancelFutureAt(int index) {
-        Q_UNUSED(index);
+        settleFutureAt(index, true);
+    }
 
+    void settleFutureAt(int index, bool canceled) {
         mutex.lock();
+        if (futures[index]->settled) {
+            mutex.unlock();
+            return;
+        }
+        futures[index]->settled = true;
+        if (futures[index]->timerId != 0) {
+            TimerService::instance()->disarm(futures[index]->timerId);
+            futures[index]->timerId = 0;
+        }
         settledCount++;
-        anyCanceled = true;
+        if (canceled) {
+            anyCanceled = true;
+        }
         finishProgress(index);
+        auto callbacks = settledCallbacks;
+        const Outcome outcome = decideOutcome();
         mutex.unlock();
 
-        checkFulfilled();
-    }
+        for (auto& callback : callbacks) {
+            callback(index);
+        }
 
-    void checkFulfilled() {
-        if (isFinished()) {
+        if (outcome == Outcome::Pending || isFinished()) {
             return;
         }
 
-        if (anyCanceled && !settleAllMode) {
+        if (outcome == Outcome::Canceled) {
             cancel();
-            return;
+        } else {
+            complete();
+        }
+    }
+
+    // It should be called with mutex locked. A child may be settled by the
+    // TimerService thread and by a watcher at the same time, so the outcome
+    // is decided once under the lock and reported after it is released.
+    Outcome decideOutcome() {
+        if (decided) {
+            return Outcome::Pending;
+        }
+
+        if (anyCanceled && (!settleAllMode || settledCount == count)) {
+            decided = true;
+            return Outcome::Canceled;
         }
 
         if (settledCount == count) {
-            if (anyCanceled) {
-                cancel();
-            } else {
-                complete();
-            }
+            decided = true;
+            return Outcome::Completed;
         }
+
+        return Outcome::Pending;
     }
 
     void updateProgressRange() {
@@ -991,60 +1950,95 @@ private:
 
 };
 
-/// Proxy is a proxy class to connect a QObject signal to a callback function
-template <typename ARG>
-class Proxy : public QObject {
-public:
-    Proxy(QObject* parent) : QObject(parent) {
+inline Qt::ConnectionType connectionType(ConnectionPolicy policy) {
+    switch (policy) {
+    case ConnectionPolicy::Direct:
+        return Qt::DirectConnection;
+    case ConnectionPolicy::Auto:
+        return Qt::AutoConnection;
+    default:
+        return Qt::QueuedConnection;
     }
+}
 
+/// The method index and parameter types of a signal
+class SignalMetadata {
+public:
+    int index = -1;
     QVector<int> parameterTypes;
-    std::function<void(Value<ARG>)> callback;
-    QMetaObject::Connection conn;
-    QPointer<QObject> sender;
+};
 
-    template <typename Method>
-    void bind(QObject* source, Method pointToMemberFunction) {
-        sender = source;
+/* SignalMetadataCache resolves signals once per (QMetaObject, signature)
+ * or (QMetaObject, method index). Entries are never removed, since meta
+ * objects live as long as the program.
+ */
+class SignalMetadataCache {
+public:
+    static SignalMetadataCache* instance() {
+        static SignalMetadataCache cache;
+        return &cache;
+    }
 
-        const int memberOffset = QObject::staticMetaObject.methodCount();
+    /// Lookup by a normalized signature, optionally prefixed by the SIGNAL() code
+    inline SignalMetadata lookup(const QMetaObject* metaObject, const QString& signature) {
+        const QPair<const QMetaObject*, QString> key(metaObject, signature);
 
-        QMetaMethod method = QMetaMethod::fromSignal(pointToMemberFunction);
+        {
+            QReadLocker locker(&lock);
+            auto iter = bySignature.constFind(key);
+            if (iter != bySignature.constEnd()) {
+                return iter.value();
+            }
+        }
 
-        parameterTypes = QVector<int>(method.parameterCount());
+        QByteArray name = signature.toUtf8();
 
-        for (int i = 0 ; i < method.parameterCount() ; i++) {
-            parameterTypes[i] = method.parameterType(i);
+        // Remove leading number
+        int prefix = 0;
+        while (prefix < name.size() && name.at(prefix) >= '0' && name.at(prefix) <= '9') {
+            prefix++;
         }
+        name.remove(0, prefix);
 
-        conn = QMetaObject::connect(source, method.methodIndex(), this, memberOffset, Qt::QueuedConnection, 0);
-
-        if (!conn) {
-            qWarning() << "AsyncFuture::Private::Proxy: Failed to bind signal";
+        SignalMetadata metadata;
+        metadata.index = metaObject->indexOfSignal(name.constData());
+        if (metadata.index >= 0) {
+            metadata = lookup(metaObject->method(metadata.index));
         }
+
+        QWriteLocker locker(&lock);
+        bySignature.insert(key, metadata);
+        return metadata;
     }
 
-    int qt_metacall(QMetaObject::Call _c, int _id, void **_a) {
-        int methodId = QObject::qt_metacall(_c, _id, _a);
+    inline SignalMetadata lookup(const QMetaMethod& method) {
+        const QPair<const QMetaObject*, int> key(method.enclosingMetaObject(), method.methodIndex());
 
-        if (methodId < 0) {
-            return methodId;
+        {
+            QReadLocker locker(&lock);
+            auto iter = byIndex.constFind(key);
+            if (iter != byIndex.constEnd()) {
+                return iter.value();
+            }
         }
 
-        if (_c == QMetaObject::InvokeMetaMethod) {
-            if (methodId == 0) {
-                sender->disconnect(conn);
-                if (parameterTypes.count() > 0) {
-                    Value<ARG> value(reinterpret_cast<ARG*>(_a[1]));
-                    callback(value);
-                } else {
-                    // It is triggered only if ARG==void.
-                    callback(Value<ARG>((ARG*) 0));
-                }
-            }
+        SignalMetadata metadata;
+        metadata.index = method.methodIndex();
+        metadata.parameterTypes = QVector<int>(method.parameterCount());
+
+        for (int i = 0 ; i < method.parameterCount() ; i++) {
+            metadata.parameterTypes[i] = method.parameterType(i);
         }
-        return methodId;
+
+        QWriteLocker locker(&lock);
+        byIndex.insert(key, metadata);
+        return metadata;
     }
+
+private:
+    QReadWriteLock lock;
+    QHash<QPair<const QMetaObject*, QString>, SignalMetadata> bySignature;
+    QHash<QPair<const QMetaObject*, int>, SignalMetadata> byIndex;
 };
 
 /// To bind a signal in const char* to callback
@@ -1058,30 +2052,21 @@ public:
     QMetaObject::Connection conn;
     QPointer<QObject> sender;
 
-    inline bool bind(QObject* source, QString signal) {
+    inline bool bind(QObject* source, const QString& signal, Qt::ConnectionType type = Qt::QueuedConnection) {
         sender = source;
 
-        // Remove leading number
-        signal = signal.replace(QRegularExpression("^[0-9]*"), "");
-
         const int memberOffset = QObject::staticMetaObject.methodCount();
 
-        int index = source->metaObject()->indexOfSignal(signal.toUtf8().constData());
+        SignalMetadata metadata = SignalMetadataCache::instance()->lookup(source->metaObject(), signal);
 
-        if (index < 0) {
+        if (metadata.index < 0) {
             qWarning() << "AsyncFuture::Private::Proxy: No such signal: " << signal;
             return false;
         }
 
-        QMetaMethod method = source->metaObject()->method(index);
+        parameterTypes = metadata.parameterTypes;
 
-        parameterTypes = QVector<int>(method.parameterCount());
-
-        for (int i = 0 ; i < method.parameterCount() ; i++) {
-            parameterTypes[i] = method.parameterType(i);
-        }
-
-        conn = QMetaObject::connect(source, method.methodIndex(), this, memberOffset, Qt::QueuedConnection, 0);
+        conn = QMetaObject::connect(source, metadata.index, this, memberOffset, type, 0);
 
         if (!conn) {
             qWarning() << "AsyncFuture::Private::Proxy: Failed to bind signal";
@@ -1119,48 +2104,404 @@ public:
 
 };
 
-/* call() : Run functor(future):void */
+/// Connect a signal to an emitter with a functor connection. The connection
+/// is released with the context object, or with the sender if context is null.
+template <typename T, typename Member>
+QMetaObject::Connection connectSignal(QObject* object,
+                                      Member pointToMemberFunction,
+                                      std::function<void(const Value<T>&)> emitter,
+                                      const QObject* context = nullptr,
+                                      Qt::ConnectionType type = Qt::DirectConnection) {
+    typedef typename signal_traits<Member>::object_type ObjectType;
+    auto sender = static_cast<ObjectType*>(object);
+
+    if (context == nullptr) {
+        context = sender;
+    }
 
-template<typename Functor, typename T>
-using CallerRetType = decltype(std::declval<Functor>()(std::declval<T>()));
+    if constexpr (std::is_same<T, void>::value) {
+        return QObject::connect(sender, pointToMemberFunction, context, [emitter]() {
+            emitter(Value<void>());
+        }, type);
+    } else if constexpr (signal_tuple_traits<T>::is_tuple) {
+        return QObject::connect(sender, pointToMemberFunction, context, signal_tuple_traits<T>::functor([emitter](T&& value) {
+            emitter(Value<T>(std::move(value)));
+        }), type);
+    } else if constexpr (std::is_empty<T>::value) {
+        // An empty argument carries no data. It is usually the QPrivateSignal
+        // tag of a private signal, which a queued call doesn't pass on.
+        return QObject::connect(sender, pointToMemberFunction, context, [emitter]() {
+            emitter(Value<T>());
+        }, type);
+    } else {
+        return QObject::connect(sender, pointToMemberFunction, context, [emitter](const T& value) {
+            emitter(Value<T>(const_cast<T*>(&value)));
+        }, type);
+    }
+}
 
+/* SignalOperators<T> transform the emissions of a signal before they reach
+ * the stream, future or predicate of a SignalObservable. An operator wraps
+ * the emitter of each connection with its own state. Timed operators share
+ * the TimerService thread, so the transformed emissions may be delivered
+ * from there.
+ */
+template <typename T>
+class SignalOperators {
+public:
+    typedef std::function<void(const Value<T>&)> Emitter;
+    typedef std::function<QMetaObject::Connection(QObject*, Emitter)> Connector;
+    typedef std::function<Emitter(Emitter)> Operator;
 
-template <typename Future> struct is_qfuture : std::false_type {};
-template <typename T> struct is_qfuture<QFuture<T>> : std::true_type { };
+    static Connector pipe(Connector upstream, Operator op) {
+        return [upstream, op](QObject* object, Emitter emitter) {
+            return upstream(object, op(emitter));
+        };
+    }
 
-// Case 1: Functor takes QFuture<T>
-template <typename Functor, typename T>
-auto callIgnoreReturn(Functor& functor, QFuture<T> value)
-    -> std::enable_if_t<std::is_invocable_v<Functor, QFuture<T>>, CallerRetType<Functor, QFuture<T>>> {
-    functor(value);
-}
+    /// Emit the latest value once no value is emitted for msec
+    static Operator debounce(int msec) {
+        return [msec](Emitter emitter) -> Emitter {
+            auto state = QSharedPointer<TimedState>::create();
+            return [state, emitter, msec](const Value<T>& value) {
+                QMutexLocker locker(&state->mutex);
+                state->latest = value;
+                const quint64 generation = ++state->generation;
+                if (state->timerId != 0) {
+                    TimerService::instance()->disarm(state->timerId);
+                }
+                state->timerId = TimerService::instance()->arm(QDeadlineTimer(msec, Qt::PreciseTimer), [state, emitter, generation]() {
+                    QMutexLocker locker(&state->mutex);
+                    if (state->generation != generation || !state->latest.has_value()) {
+                        // Superseded by a newer emission
+                        return;
+                    }
+                    Value<T> latest = std::move(*state->latest);
+                    state->latest.reset();
+                    state->timerId = 0;
+                    locker.unlock();
+                    emitter(latest);
+                });
+            };
+        };
+    }
 
-// Case 2: Functor takes T directly
-#if QT_VERSION >= 0x060000
-template <typename Functor, typename T>
-auto callIgnoreReturn(Functor& functor, QFuture<T> value)
-    -> std::enable_if_t<std::is_invocable_v<Functor, T>, CallerRetType<Functor, T>> {
-    functor(value.result());
-}
-#endif
+    /// Emit a value, then drop the values emitted in the next msec
+    static Operator throttle(int msec) {
+        return [msec](Emitter emitter) -> Emitter {
+            auto state = QSharedPointer<TimedState>::create();
+            return [state, emitter, msec](const Value<T>& value) {
+                const qint64 now = QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+                {
+                    QMutexLocker locker(&state->mutex);
+                    if (state->windowEnd > now) {
+                        return;
+                    }
+                    state->windowEnd = now + qint64(msec) * 1000 * 1000;
+                }
+                emitter(value);
+            };
+        };
+    }
 
-// Case 3: Unsupported
-template <typename Functor, typename T>
-auto callIgnoreReturn(Functor& functor, QFuture<T> value) -> std::enable_if_t<!std::is_invocable_v<Functor, QFuture<T>> && !std::is_invocable_v<Functor, T>, void> {
-    static_assert(sizeof(Functor) == 0, "The callback function is not callable. The input argument doesn't match with the observing QFuture type");
-}
+    /// Emit the latest value every msec, if there is a new one
+    static Operator sample(int msec) {
+        return [msec](Emitter emitter) -> Emitter {
+            auto state = QSharedPointer<TimedState>::create();
+            return [state, emitter, msec](const Value<T>& value) {
+                QMutexLocker locker(&state->mutex);
+                state->latest = value;
+                if (state->timerId == 0) {
+                    armSample(state, emitter, msec);
+                }
+            };
+        };
+    }
 
-// Case 1: Functor takes QFuture<T>
-template <typename Functor, typename T>
-auto call(Functor& functor, QFuture<T> value)
-    -> std::enable_if_t<std::is_invocable_v<Functor, QFuture<T>>, CallerRetType<Functor, QFuture<T>>> {
-    return functor(value);
-}
+    /// Drop a value that is equal to the previous one
+    static Operator distinctUntilChanged() {
+        static_assert(!std::is_same<T, void>::value, "distinctUntilChanged() is not available for a signal without argument");
 
-// Case 2: Functor takes T directly
-#if QT_VERSION >= 0x060000
-template <typename Functor, typename T>
-auto call(Functor& functor, QFuture<T> value)
+        return [](Emitter emitter) -> Emitter {
+            auto state = QSharedPointer<TimedState>::create();
+            return [state, emitter](const Value<T>& value) {
+                {
+                    QMutexLocker locker(&state->mutex);
+                    if (state->latest.has_value() && state->latest->value == value.value) {
+                        return;
+                    }
+                    state->latest = value;
+                }
+                emitter(value);
+            };
+        };
+    }
+
+private:
+    class TimedState {
+    public:
+        QMutex mutex;
+        std::optional<Value<T>> latest;
+        TimerService::TimerId timerId = 0;
+        quint64 generation = 0;
+        qint64 windowEnd = std::numeric_limits<qint64>::min();
+    };
+
+    // The mutex of state is held
+    static void armSample(QSharedPointer<TimedState> state, Emitter emitter, int msec) {
+        state->timerId = TimerService::instance()->arm(QDeadlineTimer(msec, Qt::PreciseTimer), [state, emitter, msec]() {
+            QMutexLocker locker(&state->mutex);
+            if (!state->latest.has_value()) {
+                // Idle, the next emission starts sampling again
+                state->timerId = 0;
+                return;
+            }
+            Value<T> latest = std::move(*state->latest);
+            state->latest.reset();
+            armSample(state, emitter, msec);
+            locker.unlock();
+            emitter(latest);
+        });
+    }
+};
+
+/* The future of a single shot observation, owned by the functor of its
+ * connection. It is canceled if it is released before the emission, i.e.
+ * together with the connection when the object is destroyed.
+ */
+template <typename T>
+class SignalOnce {
+public:
+    QFutureInterface<T> fi{QFutureInterface<T>::Started};
+
+    ~SignalOnce() {
+        if (!fi.isFinished()) {
+            fi.reportCanceled();
+            fi.reportFinished();
+        }
+    }
+
+    void complete(const Value<T>& value) {
+        if (fi.isFinished()) {
+            return;
+        }
+        if constexpr (!std::is_same<T, void>::value) {
+            fi.reportResult(value.value);
+        }
+        fi.reportFinished();
+    }
+};
+
+/// The shared data of a SignalObservable
+template <typename T>
+class SignalSource {
+public:
+    QPointer<QObject> object;
+
+    // Create a single shot observation of the signal. It is not set if the
+    // emissions pass through SignalOperators.
+    std::function<QFuture<T>(QObject*)> observeOnce;
+
+    // Connect the signal to an emitter for the whole lifetime of the connection
+    std::function<QMetaObject::Connection(QObject*, std::function<void(const Value<T>&)>)> connector;
+
+    QMutex mutex;
+    bool materialized = false;
+    QFuture<T> future;
+};
+
+/* SignalStream appends one result per emission to a multi-result future.
+ *
+ * Emissions are received by a direct connection on the emitter's thread and
+ * buffered. The buffer is delivered to the future in batches on the main
+ * thread, with at most one queued event at a time, so a burst of emissions
+ * costs a single event loop turn. For a void signal, the result is the
+ * index of the emission.
+ */
+template <typename T>
+class SignalStream {
+public:
+    typedef typename std::conditional<std::is_same<T, void>::value, int, T>::type ResultType;
+
+    QFutureInterface<ResultType> fi;
+    QMutex mutex;
+    QWaitCondition drained;
+    QList<ResultType> pending;
+    int capacity = 0;
+    OverflowPolicy policy = OverflowPolicy::DropOldest;
+    int emitted = 0;
+    bool flushQueued = false;
+    bool ended = false;
+    QMetaObject::Connection signalConnection;
+    QMetaObject::Connection destroyedConnection;
+    QWeakPointer<SignalStream<T>> weakRef;
+
+    SignalStream() {
+        fi.reportStarted();
+    }
+
+    ~SignalStream() {
+        if (!fi.isFinished()) {
+            fi.reportCanceled();
+            fi.reportFinished();
+        }
+    }
+
+    static QSharedPointer<SignalStream<T>> create(int capacity, OverflowPolicy policy) {
+        auto ptr = QSharedPointer<SignalStream<T>>::create();
+        ptr->weakRef = ptr.toWeakRef();
+        ptr->capacity = capacity;
+        ptr->policy = policy;
+        return ptr;
+    }
+
+    void push(const Value<T>& value) {
+        QMutexLocker locker(&mutex);
+        if (ended) {
+            return;
+        }
+
+        if (fi.isCanceled()) {
+            locker.unlock();
+            stop();
+            return;
+        }
+
+        if (capacity > 0 && pending.size() >= capacity) {
+            switch (policy) {
+            case OverflowPolicy::DropOldest:
+                pending.removeFirst();
+                break;
+            case OverflowPolicy::Coalesce:
+                pending.removeLast();
+                break;
+            case OverflowPolicy::Block:
+                if (QThread::currentThread() == QCoreApplication::instance()->thread()) {
+                    // Blocking the delivering thread would never drain the buffer
+                    deliver(locker);
+                } else {
+                    while (pending.size() >= capacity && !ended) {
+                        drained.wait(&mutex);
+                    }
+                    if (ended) {
+                        return;
+                    }
+                }
+                break;
+            }
+        }
+
+        if constexpr (std::is_same<T, void>::value) {
+            Q_UNUSED(value);
+            pending.append(emitted);
+        } else {
+            pending.append(value.value);
+        }
+        emitted++;
+
+        if (!flushQueued) {
+            flushQueued = true;
+            auto self = weakRef.toStrongRef();
+            QMetaObject::invokeMethod(QCoreApplication::instance(), [self]() {
+                self->flush();
+            }, Qt::QueuedConnection);
+        }
+    }
+
+    void flush() {
+        QMutexLocker locker(&mutex);
+        flushQueued = false;
+        deliver(locker);
+    }
+
+    /// The future is canceled. Release the connections and finish it.
+    void stop() {
+        QMutexLocker locker(&mutex);
+        if (ended) {
+            return;
+        }
+        ended = true;
+        pending.clear();
+        drained.wakeAll();
+        locker.unlock();
+
+        QObject::disconnect(signalConnection);
+        QObject::disconnect(destroyedConnection);
+        fi.reportFinished();
+    }
+
+    /// The observed object is destroyed
+    void end() {
+        QMutexLocker locker(&mutex);
+        if (ended) {
+            return;
+        }
+        ended = true;
+        drained.wakeAll();
+
+        auto self = weakRef.toStrongRef();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self]() {
+            self->flush();
+            self->fi.reportFinished();
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    void deliver(QMutexLocker<QMutex>& locker) {
+        QList<ResultType> batch;
+        batch.swap(pending);
+        drained.wakeAll();
+
+        locker.unlock();
+        if (!batch.isEmpty()) {
+            fi.reportResults(batch);
+        }
+        locker.relock();
+    }
+};
+
+/* call() : Run functor(future):void */
+
+template<typename Functor, typename T>
+using CallerRetType = decltype(std::declval<Functor>()(std::declval<T>()));
+
+
+template <typename Future> struct is_qfuture : std::false_type {};
+template <typename T> struct is_qfuture<QFuture<T>> : std::true_type { };
+
+// Case 1: Functor takes QFuture<T>
+template <typename Functor, typename T>
+auto callIgnoreReturn(Functor& functor, QFuture<T> value)
+    -> std::enable_if_t<std::is_invocable_v<Functor, QFuture<T>>, CallerRetType<Functor, QFuture<T>>> {
+    functor(value);
+}
+
+// Case 2: Functor takes T directly
+#if QT_VERSION >= 0x060000
+template <typename Functor, typename T>
+auto callIgnoreReturn(Functor& functor, QFuture<T> value)
+    -> std::enable_if_t<std::is_invocable_v<Functor, T>, CallerRetType<Functor, T>> {
+    functor(value.result());
+}
+#endif
+
+// Case 3: Unsupported
+template <typename Functor, typename T>
+auto callIgnoreReturn(Functor& functor, QFuture<T> value) -> std::enable_if_t<!std::is_invocable_v<Functor, QFuture<T>> && !std::is_invocable_v<Functor, T>, void> {
+    static_assert(sizeof(Functor) == 0, "The callback function is not callable. The input argument doesn't match with the observing QFuture type");
+}
+
+// Case 1: Functor takes QFuture<T>
+template <typename Functor, typename T>
+auto call(Functor& functor, QFuture<T> value)
+    -> std::enable_if_t<std::is_invocable_v<Functor, QFuture<T>>, CallerRetType<Functor, QFuture<T>>> {
+    return functor(value);
+}
+
+// Case 2: Functor takes T directly
+#if QT_VERSION >= 0x060000
+template <typename Functor, typename T>
+auto call(Functor& functor, QFuture<T> value)
     -> std::enable_if_t<std::is_invocable_v<Functor, T>, CallerRetType<Functor, T>> {
     return functor(value.result());
 }
@@ -1232,7 +2573,8 @@ public:
  * e.g DeferredFuture<int> = Value<QFuture<int>>
  */
 template <typename DeferredType, typename RetType, typename T, typename Completed, typename Canceled>
-static QFuture<DeferredType> execute(QFuture<T> future, const QObject* contextObject, Completed onCompleted, Canceled onCanceled) {
+static QFuture<DeferredType> execute(QFuture<T> future, const QObject* contextObject, Completed onCompleted, Canceled onCanceled,
+                                     Priority priority = Priority::Normal) {
 
     auto defer = DeferredFuture<DeferredType>::create();
 
@@ -1241,9 +2583,7 @@ static QFuture<DeferredType> execute(QFuture<T> future, const QObject* contextOb
 
     auto cancelOnce = QSharedPointer<CancelOnce<Canceled>>::create(onCanceled);
 
-    watch(future,
-          contextObject,
-          contextObject,[=]() {
+    auto complete = [=]() {
         try {
             Value<RetType> value = eval(onCompleted, future);
             defer->complete(value);
@@ -1254,6 +2594,16 @@ static QFuture<DeferredType> execute(QFuture<T> future, const QObject* contextOb
             defer->reportException(QUnhandledException());
             defer->cancel();
         }
+    };
+
+    watch(future,
+          contextObject,
+          contextObject,[=]() {
+        if (priority == Priority::Normal) {
+            complete();
+        } else {
+            PriorityDispatcher::post(contextObject, priority, complete);
+        }
     }, [=]() {
         cancelOnce->cancel();
         defer->cancel();
@@ -1285,6 +2635,185 @@ static QFuture<DeferredType> execute(QFuture<T> future, const QObject* contextOb
     return defer->future();
 }
 
+/// The shared state of mapConcurrent(). Inputs are claimed by an atomic
+/// counter. `launched` is read by the canceling thread too, so it is
+/// guarded by the mutex.
+template <typename Input, typename R>
+class MapConcurrent {
+public:
+    QList<Input> inputs;
+    std::function<QFuture<R>(const Input&)> functor;
+    QSharedPointer<DeferredFuture<R>> defer;
+    QMutex mutex;
+    std::vector<QFuture<R>> launched;
+    QAtomicInt next = 0;
+    QAtomicInt finishedCount = 0;
+
+    static void launch(QSharedPointer<MapConcurrent> self) {
+        const int index = self->next.fetchAndAddOrdered(1);
+        if (index >= self->inputs.size() || self->defer->isFinished()) {
+            return;
+        }
+
+        QFuture<R> future = self->functor(self->inputs.at(index));
+        {
+            QMutexLocker locker(&self->mutex);
+            self->launched[index] = future;
+        }
+
+        if (self->defer->isCanceled()) {
+            future.cancel();
+            return;
+        }
+
+        watch(future,
+              self->defer.data(),
+              nullptr,
+              [self, index]() {
+            finish(self, index);
+        }, [self]() {
+            // Fail fast. The in-flight futures are canceled by the watcher of defer
+            self->defer->cancel();
+        },
+        [](int){},
+        [](int, int){});
+    }
+
+    static void finish(QSharedPointer<MapConcurrent> self, int index) {
+        if (self->defer->isFinished()) {
+            return;
+        }
+
+        // Release the slot, so a finished item and its result don't stay
+        // alive until the whole map is completed
+        self->mutex.lock();
+        QFuture<R> future = std::exchange(self->launched[index], QFuture<R>());
+        self->mutex.unlock();
+
+        if constexpr (!std::is_same<R, void>::value) {
+            if (future.resultCount() > 0) {
+                R value = future.result();
+                self->defer->reportResult(value, index);
+            }
+        } else {
+            Q_UNUSED(future);
+        }
+
+        const int count = self->finishedCount.fetchAndAddOrdered(1) + 1;
+        self->defer->setProgressValue(count);
+
+        if (count >= self->inputs.size()) {
+            self->defer->complete();
+        } else {
+            launch(self);
+        }
+    }
+
+    void cancelLaunched() {
+        mutex.lock();
+        std::vector<QFuture<R>> futures = launched;
+        mutex.unlock();
+
+        for (QFuture<R>& future : futures) {
+            if (future.isRunning()) {
+                future.cancel();
+            }
+        }
+    }
+};
+
+/* WaitService owns a thread with an event loop for the watchers of the
+ * blocking waits, so a thread without an event loop can be woken up when
+ * a future is finished.
+ */
+class WaitService {
+public:
+    static WaitService* instance() {
+        static WaitService service;
+        return &service;
+    }
+
+    QThread* thread() const {
+        return m_thread;
+    }
+
+    ~WaitService() {
+        m_thread->quit();
+        m_thread->wait();
+        delete m_thread;
+    }
+
+private:
+    QThread* m_thread;
+
+    WaitService() {
+        m_thread = new QThread();
+        m_thread->setObjectName(QStringLiteral("AsyncFuture::WaitService"));
+        m_thread->start();
+    }
+};
+
+/* Park the calling thread until every future is finished (or any of them,
+ * if `any` is true), or timeout msec (-1 = forever) has passed. Each
+ * unfinished future gets a QFutureWatcher on the WaitService thread, which
+ * wakes the caller up. A continuation would replace the caller's then(),
+ * and QFuture has no timed wait.
+ */
+template <typename T>
+bool blockOn(const QList<QFuture<T>>& futures, bool any, int timeout) {
+    auto settled = [&]() {
+        auto isFinished = [](const QFuture<T>& future) {
+            return future.isFinished();
+        };
+        return any ? std::any_of(futures.begin(), futures.end(), isFinished) :
+                     std::all_of(futures.begin(), futures.end(), isFinished);
+    };
+
+    if (settled()) {
+        return true;
+    }
+
+    class Waiter {
+    public:
+        QMutex mutex;
+        QWaitCondition condition;
+    };
+
+    auto waiter = std::make_shared<Waiter>();
+    QList<QFutureWatcher<T>*> watchers;
+
+    for (const QFuture<T>& future : futures) {
+        if (future.isFinished()) {
+            continue;
+        }
+        auto watcher = new QFutureWatcher<T>();
+        QObject::connect(watcher, &QFutureWatcher<T>::finished, watcher, [waiter]() {
+            QMutexLocker locker(&waiter->mutex);
+            waiter->condition.wakeAll();
+        });
+        // Set up while the watcher still belongs to this thread. Its pending
+        // events move with it to the service thread.
+        watcher->setFuture(future);
+        watcher->moveToThread(WaitService::instance()->thread());
+        watchers << watcher;
+    }
+
+    QDeadlineTimer deadline(timeout < 0 ? QDeadlineTimer(QDeadlineTimer::Forever) : QDeadlineTimer(timeout, Qt::PreciseTimer));
+    bool result = false;
+    {
+        // The wake up is sent under the lock after the future is finished, so it can't be missed
+        QMutexLocker locker(&waiter->mutex);
+        while (!(result = settled()) && !deadline.hasExpired()) {
+            waiter->condition.wait(&waiter->mutex, deadline);
+        }
+    }
+
+    for (auto watcher : watchers) {
+        watcher->deleteLater();
+    }
+    return result;
+}
+
 } // End of Private Namespace
 
 /* Start of AsyncFuture Namespace */
@@ -1296,6 +2825,7 @@ template <typename T>
 class Observable {
 protected:
     QFuture<T> m_future;
+    Priority m_priority = Priority::Normal;
 
 public:
 
@@ -1307,10 +2837,79 @@ public:
         m_future = future;
     }
 
+    Observable(QFuture<T> future, Priority priority) {
+        m_future = future;
+        m_priority = priority;
+    }
+
     [[nodiscard]] QFuture<T> future() const {
         return m_future;
     }
 
+    /* Set the priority of the chain. It is carried to the stages added by
+     * context(), subscribe() and run().
+     */
+    [[nodiscard]] Observable<T> priority(Priority priority) const {
+        return Observable<T>(m_future, priority);
+    }
+
+    Priority priority() const {
+        return m_priority;
+    }
+
+    /* Return an Observable that completes with the future, or is canceled
+     * if the future is not finished in msec. The future is canceled at the
+     * deadline too, or as soon as the returned future is canceled.
+     */
+    [[nodiscard]] Observable<T> timeout(int msec) const {
+        return Observable<T>(Private::timeoutFuture(m_future, QDeadlineTimer(msec, Qt::PreciseTimer)), m_priority);
+    }
+
+    /* Run callback(result) on the executor once the future is finished and
+     * return an Observable of its return value. The task is started with
+     * the chain's priority. The executor is a QThreadPool, or any type that
+     * has start(std::function<void()>, int priority).
+     */
+    template <typename Executor, typename Functor>
+    Observable<typename Private::RetType<Functor>> run(Executor* executor, Functor functor) {
+        typedef typename Private::RetType<Functor> R;
+        static_assert(!Private::future_traits<R>::is_future, "run(executor, callback): The callback should not return a QFuture");
+        ASYNC_FUTURE_CALLBACK_STATIC_ASSERT("run(executor, callback): ", Functor);
+
+        QFuture<T> source = m_future;
+        const int poolPriority = Private::threadPoolPriority(m_priority);
+
+        auto launch = [executor, functor, source, poolPriority]() -> QFuture<R> {
+            auto promise = std::make_shared<QPromise<R>>();
+            QFuture<R> future = promise->future();
+            promise->start();
+
+            executor->start([promise, functor, source]() {
+                if (promise->isCanceled()) {
+                    promise->finish();
+                    return;
+                }
+                try {
+                    Private::Value<R> value = Private::eval(functor, source);
+                    if constexpr (!std::is_same<R, void>::value) {
+                        promise->addResult(std::move(value.value));
+                    } else {
+                        Q_UNUSED(value);
+                    }
+                } catch (QException& e) {
+                    promise->setException(e);
+                } catch (...) {
+                    promise->setException(std::current_exception());
+                }
+                promise->finish();
+            }, poolPriority);
+
+            return future;
+        };
+
+        return _subscribe<R, QFuture<R>>(launch, [](){});
+    }
+
     template <typename Completed>
     typename std::enable_if< !Private::future_traits<typename Private::function_traits<Completed>::result_type>::is_future,
     Observable<typename Private::function_traits<Completed>::result_type>
@@ -1475,24 +3074,66 @@ public:
     }
 
 
-    void onCompleted(std::function<void()> func) {
-        subscribe(func, []() {});
-    }
-
-    void onCanceled(std::function<void()> func) {
-        subscribe([]() {}, func);
-    }
+    /* Invoke the callback on the context object's thread whenever a result
+     * is reported to the future, without waiting for it to finish. The
+     * callback takes (int index) or (int index, T result).
+     */
+    template <typename Functor>
+    void onResultReadyAt(const QObject* contextObject, Functor functor) {
+        static_assert(!std::is_same<T, void>::value, "onResultReadyAt(): QFuture<void> has no result");
+        static_assert(Private::arg_count<Functor>::value == 1 || Private::arg_count<Functor>::value == 2,
+                      "onResultReadyAt(callback): The callback should take (int index) or (int index, T result)");
 
-    void onFinished(std::function<void()> func) {
-        auto runOnMainThread = [=]() {
-            QMetaObject::invokeMethod(QCoreApplication::instance(), func, Qt::QueuedConnection);
-        };
+        QFutureWatcher<T> *watcher = new QFutureWatcher<T>();
+        QFuture<T> future = m_future;
 
-        subscribe(runOnMainThread, runOnMainThread);
-    }
+        QObject::connect(watcher, &QFutureWatcher<T>::finished,
+                         [=]() {
+            watcher->disconnect();
+            watcher->deleteLater();
+        });
 
-    template <typename ANY>
-    void onCanceled(Deferred<ANY> object) {
+        QObject::connect(watcher, &QFutureWatcher<T>::resultsReadyAt, contextObject,
+                         [=](int begin, int end) mutable {
+            for (int i = begin ; i < end ; i++) {
+                if constexpr (Private::arg_count<Functor>::value == 1) {
+                    functor(i);
+                } else {
+                    functor(i, future.resultAt(i));
+                }
+            }
+        });
+
+        if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+            watcher->moveToThread(QCoreApplication::instance()->thread());
+        }
+
+        watcher->setFuture(m_future);
+    }
+
+    template <typename Functor>
+    void onResultReadyAt(Functor functor) {
+        onResultReadyAt(QCoreApplication::instance(), functor);
+    }
+
+    void onCompleted(std::function<void()> func) {
+        subscribe(func, []() {});
+    }
+
+    void onCanceled(std::function<void()> func) {
+        subscribe([]() {}, func);
+    }
+
+    void onFinished(std::function<void()> func) {
+        auto runOnMainThread = [=]() {
+            QMetaObject::invokeMethod(QCoreApplication::instance(), func, Qt::QueuedConnection);
+        };
+
+        subscribe(runOnMainThread, runOnMainThread);
+    }
+
+    template <typename ANY>
+    void onCanceled(Deferred<ANY> object) {
         subscribe([]() {}, [=]() {
             auto o = object;
             o.cancel();
@@ -1514,9 +3155,10 @@ private:
         auto future = Private::execute<ObservableType, RetType>(m_future,
                                                                contextObject,
                                                                onCompleted,
-                                                               onCanceled);
+                                                               onCanceled,
+                                                               m_priority);
 
-        return Observable<ObservableType>(future);
+        return Observable<ObservableType>(future, m_priority);
     }
 
     template <typename ObservableType, typename RetType, typename Completed, typename Canceled>
@@ -1533,9 +3175,8 @@ template <typename T>
 class Deferred : public Observable<T> {
 
 public:
-    Deferred() : Observable<T>(),
-              deferredFuture(Private::DeferredFuture<T>::create())  {
-        this->m_future = deferredFuture->future();
+    Deferred() : Observable<T>() {
+        this->m_future = deferredFuture.interface().future();
     }
 
     void complete(QFuture<QFuture<T>> future) {
@@ -1549,15 +3190,15 @@ public:
 
     void complete(T value)
     {
-        deferredFuture->complete(value);
+        deferredFuture.complete(value);
     }
 
     void complete() {
-        deferredFuture->complete();
+        deferredFuture.complete();
     }
 
     void complete(QList<T> value) {
-        deferredFuture->complete(value);
+        deferredFuture.complete(std::move(value));
     }
 
     template <typename ANY>
@@ -1566,7 +3207,12 @@ public:
     }
 
     void cancel() {
-        deferredFuture->cancel();
+        deferredFuture.cancel();
+    }
+
+    /// Cancel the future if it is not finished after msec
+    void cancelAfter(int msec) {
+        deferredFuture.cancelAfter(msec);
     }
 
     template <typename ANY>
@@ -1575,28 +3221,48 @@ public:
     }
 
     void setProgressValue(int value) {
-        deferredFuture->setProgressValue(value);
+        deferredFuture.interface().setProgressValue(value);
     }
 
     void setProgressRange(int minimum, int maximum) {
-        deferredFuture->setProgressRange(minimum, maximum);
+        deferredFuture.interface().setProgressRange(minimum, maximum);
     }
 
     void reportStarted() {
-        deferredFuture->reportStarted();
+        deferredFuture.interface().reportStarted();
+    }
+
+    /* Append a result to the future while it is running, so observers can
+     * consume it before the production is finished. Call finish() to close
+     * the stream.
+     */
+    void reportResult(const T& value) {
+        deferredFuture.interface().reportResult(value);
+    }
+
+    void reportResult(T&& value) {
+        deferredFuture.interface().reportAndMoveResult(std::move(value));
+    }
+
+    void reportResults(const QList<T>& values) {
+        deferredFuture.interface().reportResults(values);
+    }
+
+    /// Finish the future with the results reported so far
+    void finish() {
+        deferredFuture.complete();
     }
 
 protected:
-    QSharedPointer<Private::DeferredFuture<T> > deferredFuture;
+    Private::LazyDeferredFuture<T> deferredFuture;
 };
 
 template<>
 class Deferred<void> : public Observable<void> {
 
 public:
-    Deferred() : Observable<void>(),
-              deferredFuture(Private::DeferredFuture<void>::create())  {
-        this->m_future = deferredFuture->future();
+    Deferred() : Observable<void>() {
+        this->m_future = deferredFuture.interface().future();
     }
 
     template <typename ANY>
@@ -1612,7 +3278,7 @@ public:
     }
 
     void complete() {
-        deferredFuture->complete();
+        deferredFuture.complete();
     }
 
     template <typename ANY>
@@ -1621,7 +3287,12 @@ public:
     }
 
     void cancel() {
-        deferredFuture->cancel();
+        deferredFuture.cancel();
+    }
+
+    /// Cancel the future if it is not finished after msec
+    void cancelAfter(int msec) {
+        deferredFuture.cancelAfter(msec);
     }
 
     template <typename ANY>
@@ -1630,11 +3301,213 @@ public:
     }
 
     void reportStarted() {
-        deferredFuture->reportStarted();
+        deferredFuture.interface().reportStarted();
     }
 
 protected:
-    QSharedPointer<Private::DeferredFuture<void> > deferredFuture;
+    Private::LazyDeferredFuture<void> deferredFuture;
+};
+
+/* Promise<T> is a movable, QObject free alternative to Deferred<T> for
+ * producers running in worker threads. It wraps a started QPromise<T>, so
+ * completing it from any thread doesn't post an event. Its future could be
+ * used with observe() and combine() like any other QFuture. Only
+ * complete(QFuture) and track() create a QFutureWatcher.
+ *
+ * If the promise is destroyed before it is finished, the future is canceled.
+ */
+template <typename T>
+class Promise {
+public:
+    Promise() : d(QSharedPointer<State>::create()) {
+    }
+
+    Promise(Promise&& other) = default;
+    Promise& operator=(Promise&& other) = default;
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    [[nodiscard]] QFuture<T> future() const {
+        return d->promise.future();
+    }
+
+    /// True if the future is canceled, e.g. by its consumer
+    bool isCanceled() const {
+        return d->promise.isCanceled();
+    }
+
+    void complete() {
+        QMutexLocker locker(&d->mutex);
+        d->finish();
+    }
+
+    template <typename R>
+    typename std::enable_if<!std::is_same<T, void>::value && std::is_convertible<R&&, T>::value, void>::type
+    complete(R&& value) {
+        QMutexLocker locker(&d->mutex);
+        if (!d->isFinished()) {
+            d->promise.addResult(std::forward<R>(value));
+            d->finish();
+        }
+    }
+
+    template <typename R>
+    typename std::enable_if<std::is_same<R, T>::value, void>::type
+    complete(const QList<R>& values) {
+        QMutexLocker locker(&d->mutex);
+        if (!d->isFinished()) {
+            d->promise.addResults(values);
+            d->finish();
+        }
+    }
+
+    /* Complete or cancel together with the input future. The state is
+     * forwarded by a QFutureWatcher on the main thread. A QFuture keeps a
+     * single continuation, so the caller's then() on the input is left alone.
+     */
+    void complete(QFuture<T> future) {
+        auto state = d;
+        watch(future, [state](QFuture<T> input) {
+            state->completeBy(input);
+        }, nullptr);
+    }
+
+    void cancel() {
+        d->cancel();
+    }
+
+    /// Forward the progress of the target future until it is finished
+    template <typename ANY>
+    void track(QFuture<ANY> target) {
+        auto state = d;
+        auto trackProgress = [state](QFuture<ANY> input) {
+            state->trackProgress(input);
+        };
+        watch(target, trackProgress, trackProgress);
+    }
+
+    void setProgressRange(int minimum, int maximum) {
+        QMutexLocker locker(&d->mutex);
+        d->promise.setProgressRange(minimum, maximum);
+    }
+
+    void setProgressValue(int value) {
+        QMutexLocker locker(&d->mutex);
+        d->promise.setProgressValue(value);
+    }
+
+    /// Append a result while the future is running
+    template <typename R>
+    typename std::enable_if<!std::is_same<T, void>::value && std::is_convertible<R&&, T>::value, void>::type
+    reportResult(R&& value) {
+        QMutexLocker locker(&d->mutex);
+        d->promise.addResult(std::forward<R>(value));
+    }
+
+    template <typename R>
+    typename std::enable_if<std::is_same<R, T>::value, void>::type
+    reportResults(const QList<R>& values) {
+        QMutexLocker locker(&d->mutex);
+        d->promise.addResults(values);
+    }
+
+private:
+    /* Call onSettled(input) once the input is finished or canceled, and
+     * onProgress(input) when its progress is changed, if it is set.
+     */
+    template <typename ANY, typename Settled, typename Progress>
+    static void watch(QFuture<ANY> input, Settled onSettled, Progress onProgress) {
+        if (input.isFinished()) {
+            onSettled(input);
+            return;
+        }
+
+        auto watcher = new QFutureWatcher<ANY>();
+        auto settle = [watcher, input, onSettled]() {
+            watcher->disconnect();
+            watcher->deleteLater();
+            onSettled(input);
+        };
+
+        QObject::connect(watcher, &QFutureWatcher<ANY>::finished, settle);
+        QObject::connect(watcher, &QFutureWatcher<ANY>::canceled, settle);
+
+        if constexpr (!std::is_same<Progress, std::nullptr_t>::value) {
+            QObject::connect(watcher, &QFutureWatcher<ANY>::progressValueChanged, [input, onProgress]() {
+                onProgress(input);
+            });
+            QObject::connect(watcher, &QFutureWatcher<ANY>::progressRangeChanged, [input, onProgress]() {
+                onProgress(input);
+            });
+        }
+
+        if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+            watcher->moveToThread(QCoreApplication::instance()->thread());
+        }
+
+        watcher->setFuture(input);
+    }
+
+    class State {
+    public:
+        QMutex mutex;
+        QPromise<T> promise;
+
+        State() {
+            promise.start();
+        }
+
+        // The mutex is held
+        bool isFinished() {
+            return promise.future().isFinished();
+        }
+
+        // The mutex is held
+        void finish() {
+            if (!isFinished()) {
+                promise.finish();
+            }
+        }
+
+        void cancel() {
+            QMutexLocker locker(&mutex);
+            if (!isFinished()) {
+                promise.future().cancel();
+                promise.finish();
+            }
+        }
+
+        void completeBy(QFuture<T> input) {
+            if (input.isCanceled()) {
+                cancel();
+                return;
+            }
+
+            QMutexLocker locker(&mutex);
+            if (isFinished()) {
+                return;
+            }
+            if constexpr (!std::is_same<T, void>::value) {
+                if (input.resultCount() > 0) {
+                    promise.addResults(input.results());
+                }
+            }
+            promise.finish();
+        }
+
+        template <typename ANY>
+        void trackProgress(QFuture<ANY> input) {
+            QMutexLocker locker(&mutex);
+            if (isFinished()) {
+                return;
+            }
+            promise.setProgressRange(input.progressMinimum(), input.progressMaximum());
+            promise.setProgressValue(input.progressValue());
+        }
+    };
+
+    QSharedPointer<State> d;
 };
 
 typedef enum {
@@ -1642,6 +3515,16 @@ typedef enum {
     AllSettled
 } CombinatorMode;
 
+/* The order of results reported by Combinator::stream().
+ * Unordered reports a child's results as soon as it settles. Ordered
+ * follows the order the children were added, holding a result back until
+ * every earlier child has settled.
+ */
+enum class StreamOrder {
+    Unordered,
+    Ordered
+};
+
 class Combinator : public Observable<void> {
 private:
     QSharedPointer<Private::CombinedFuture> combinedFuture;
@@ -1684,6 +3567,126 @@ public:
         combinedFuture->addFuture(deferred.future());
         return *this;
     }
+
+    template <typename T>
+    Combinator& operator<<(const Promise<T>& promise) {
+        combinedFuture->addFuture(promise.future());
+        return *this;
+    }
+
+    /* Add a future that must be settled before the deadline. An expired
+     * child is canceled and counted as canceled according to the mode.
+     */
+    template <typename T>
+    Combinator& addFuture(QFuture<T> future, QDeadlineTimer deadline) {
+        combinedFuture->addFuture(future, deadline);
+        return *this;
+    }
+
+    /* Give every child msec milliseconds to settle. It applies to the
+     * children added afterwards and to the pending children (counting from
+     * now). The deadlines share a single timer service instead of a QTimer
+     * per child.
+     */
+    Combinator& withTimeout(int msec) {
+        combinedFuture->setTimeout(msec);
+        return *this;
+    }
+
+    /* Invoke the callback on the context object's thread whenever a child
+     * future is settled (completed or canceled), so the early results can be
+     * consumed before the slowest child is finished. The callback takes
+     * (int index) or (int index, QFuture<T> future), where index is the
+     * order of the child added to the combinator.
+     */
+    template <typename Functor>
+    Combinator& onEach(const QObject* contextObject, Functor functor) {
+        static_assert(Private::arg_count<Functor>::value == 1 || Private::arg_count<Functor>::value == 2,
+                      "onEach(callback): The callback should take (int index) or (int index, QFuture<T> future)");
+
+        QPointer<QObject> context = const_cast<QObject*>(contextObject);
+        auto combined = combinedFuture.data();
+
+        combinedFuture->onSettled([combined, context, functor](int index) {
+            if constexpr (Private::arg_count<Functor>::value == 1) {
+                Q_UNUSED(combined);
+                Private::runOnContext(context, [functor, index]() mutable {
+                    functor(index);
+                });
+            } else {
+                typedef typename std::decay<typename Private::function_traits<Functor>::template arg<1>::type>::type FutureType;
+                static_assert(Private::future_traits<FutureType>::is_future,
+                              "onEach(callback): The second argument of the callback should be a QFuture");
+
+                FutureType future = combined->template futureAt<typename Private::future_traits<FutureType>::arg_type>(index);
+                Private::runOnContext(context, [functor, index, future]() mutable {
+                    functor(index, future);
+                });
+            }
+        });
+        return *this;
+    }
+
+    /* Returns a future that reports the results of the child futures
+     * (which should all be QFuture<T>) as they arrive. A canceled child
+     * contributes no result. The returned future is finished or canceled
+     * together with the combined future.
+     */
+    template <typename T>
+    QFuture<T> stream(StreamOrder order = StreamOrder::Unordered) {
+        class OrderState {
+        public:
+            QMutex mutex;
+            int next = 0;
+            QSet<int> settled;
+        };
+
+        auto defer = Private::DeferredFuture<T>::create();
+        auto state = QSharedPointer<OrderState>::create();
+        auto combined = combinedFuture.data();
+
+        auto report = [defer, combined](int index) {
+            if constexpr (std::is_same<T, void>::value) {
+                Q_UNUSED(index);
+            } else {
+                QFuture<T> child = combined->template futureAt<T>(index);
+                if (!child.isCanceled() && child.resultCount() > 0) {
+                    defer->reportResults(child.results());
+                }
+            }
+        };
+
+        combinedFuture->onSettled([defer, state, report, order](int index) {
+            if (defer->isFinished()) {
+                return;
+            }
+
+            if (order == StreamOrder::Unordered) {
+                report(index);
+                return;
+            }
+
+            QMutexLocker locker(&state->mutex);
+            state->settled.insert(index);
+            while (state->settled.remove(state->next)) {
+                report(state->next);
+                state->next++;
+            }
+        });
+
+        Private::watch(combinedFuture->future(),
+                       defer.data(),
+                       nullptr,
+                       [defer]() {
+            defer->complete();
+        }, [defer]() {
+            defer->cancel();
+        },
+        [](int){},
+        [](int, int){});
+
+        return defer->future();
+    }
 };
 
 template <typename T>
@@ -1698,32 +3701,269 @@ static Observable<T> observe(QFuture<T> future) {
     return Observable<T>(future);
 }
 
+/* SignalObservable<T> is returned by observe(object, signal). It behaves
+ * like an Observable<T> of the next emission, which is connected by the
+ * first future() or subscribe(). A stream(), when() and the operators like
+ * debounce() take their own connection instead, so they don't connect the
+ * next emission at all.
+ */
+template <typename T>
+class SignalObservable {
+public:
+    typedef typename Private::SignalStream<T>::ResultType StreamType;
+
+    SignalObservable(QSharedPointer<Private::SignalSource<T>> source) : source(source) {
+    }
+
+    /// The future of the next emission. It is canceled if the object is destroyed before.
+    [[nodiscard]] QFuture<T> future() const {
+        QMutexLocker locker(&source->mutex);
+        if (!source->materialized) {
+            source->materialized = true;
+            if (source->object.isNull()) {
+                QFutureInterface<T> fi(QFutureInterface<T>::Started);
+                fi.reportCanceled();
+                fi.reportFinished();
+                source->future = fi.future();
+            } else if (source->observeOnce) {
+                source->future = source->observeOnce(source->object.data());
+            } else {
+                source->future = when([](auto&&...) {
+                    return true;
+                }).future();
+            }
+        }
+        return source->future;
+    }
+
+    operator Observable<T>() const {
+        return Observable<T>(future());
+    }
+
+    template <typename ...Args>
+    decltype(auto) subscribe(Args&& ...args) {
+        Observable<T> observable(future());
+        return observable.subscribe(std::forward<Args>(args)...);
+    }
+
+    template <typename ...Args>
+    decltype(auto) context(Args&& ...args) {
+        Observable<T> observable(future());
+        return observable.context(std::forward<Args>(args)...);
+    }
+
+    [[nodiscard]] Observable<T> priority(Priority priority) const {
+        return Observable<T>(future(), priority);
+    }
+
+    [[nodiscard]] Observable<T> timeout(int msec) const {
+        return Observable<T>(future()).timeout(msec);
+    }
+
+    template <typename ...Args>
+    void onProgress(Args&& ...args) {
+        Observable<T>(future()).onProgress(std::forward<Args>(args)...);
+    }
+
+    template <typename ...Args>
+    void onCompleted(Args&& ...args) {
+        Observable<T>(future()).onCompleted(std::forward<Args>(args)...);
+    }
+
+    template <typename ...Args>
+    void onCanceled(Args&& ...args) {
+        Observable<T>(future()).onCanceled(std::forward<Args>(args)...);
+    }
+
+    template <typename ...Args>
+    void onFinished(Args&& ...args) {
+        Observable<T>(future()).onFinished(std::forward<Args>(args)...);
+    }
+
+    /* Returns a multi-result future that appends one result per emission,
+     * using a single connection for its whole lifetime. For a void signal,
+     * the result is the index of the emission. The stream is finished when
+     * the object is destroyed. Cancel the future to stop it and release the
+     * connection.
+     *
+     * capacity bounds the results buffered for delivery (0 = unbounded),
+     * and policy decides what to do when the buffer is full.
+     */
+    [[nodiscard]] QFuture<StreamType> stream(int capacity = 0,
+                                             OverflowPolicy policy = OverflowPolicy::DropOldest) const {
+        auto stream = Private::SignalStream<T>::create(capacity, policy);
+        QFuture<StreamType> future = stream->fi.future();
+
+        QObject* object = source->object.data();
+        if (object == nullptr) {
+            stream->fi.reportCanceled();
+            stream->fi.reportFinished();
+            return future;
+        }
+
+        {
+            QMutexLocker locker(&stream->mutex);
+            stream->signalConnection = source->connector(object, [stream](const Private::Value<T>& value) {
+                stream->push(value);
+            });
+            stream->destroyedConnection = QObject::connect(object, &QObject::destroyed, [stream]() {
+                stream->end();
+            });
+        }
+
+        // Release the connections as soon as the future is canceled
+        QWeakPointer<Private::SignalStream<T>> weakStream = stream;
+        auto watcher = new QFutureWatcher<StreamType>();
+        QObject::connect(watcher, &QFutureWatcher<StreamType>::canceled, [weakStream]() {
+            auto strongStream = weakStream.toStrongRef();
+            if (!strongStream.isNull()) {
+                strongStream->stop();
+            }
+        });
+        QObject::connect(watcher, &QFutureWatcher<StreamType>::finished, [watcher]() {
+            watcher->disconnect();
+            watcher->deleteLater();
+        });
+        if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+            watcher->moveToThread(QCoreApplication::instance()->thread());
+        }
+        watcher->setFuture(future);
+
+        return future;
+    }
+
+    /// Emit the latest value once the signal is not emitted for msec
+    [[nodiscard]] SignalObservable<T> debounce(int msec) const {
+        return pipe(Private::SignalOperators<T>::debounce(msec));
+    }
+
+    /// Emit the first value, then drop the values emitted in the next msec
+    [[nodiscard]] SignalObservable<T> throttle(int msec) const {
+        return pipe(Private::SignalOperators<T>::throttle(msec));
+    }
+
+    /// Emit the latest value every msec, if the signal was emitted since the last one
+    [[nodiscard]] SignalObservable<T> sample(int msec) const {
+        return pipe(Private::SignalOperators<T>::sample(msec));
+    }
+
+    /// Drop a value that is equal to the previous one
+    [[nodiscard]] SignalObservable<T> distinctUntilChanged() const {
+        return pipe(Private::SignalOperators<T>::distinctUntilChanged());
+    }
+
+    /* Returns an Observable<T> of the first emission that matches the
+     * predicate. One direct connection is kept until then: the predicate
+     * runs in the emitter's thread, so non-matching emissions are never
+     * queued. The future is canceled if the object is destroyed first.
+     * The future is completed by the connection itself, no QObject is
+     * created for it.
+     */
+    template <typename Predicate>
+    [[nodiscard]] Observable<T> when(Predicate predicate) const {
+        class State {
+        public:
+            QMutex mutex;
+            QFutureInterface<T> fi{QFutureInterface<T>::Started};
+            QMetaObject::Connection connection;
+            bool done = false;
+
+            // Released with the connection, e.g. when the object is destroyed before a match
+            ~State() {
+                if (!fi.isFinished()) {
+                    fi.reportCanceled();
+                    fi.reportFinished();
+                }
+            }
+        };
+
+        auto state = QSharedPointer<State>::create();
+        Observable<T> observable(state->fi.future());
+
+        QObject* object = source->object.data();
+        if (object == nullptr) {
+            return observable;
+        }
+
+        QMutexLocker locker(&state->mutex);
+        state->connection = source->connector(object, [state, predicate](const Private::Value<T>& value) mutable {
+            bool matched = false;
+            if (!state->fi.isCanceled()) {
+                if constexpr (std::is_same<T, void>::value) {
+                    Q_UNUSED(value);
+                    matched = predicate();
+                } else {
+                    matched = predicate(value.value);
+                }
+            }
+
+            if (!matched && !state->fi.isCanceled()) {
+                return;
+            }
+
+            QMutexLocker locker(&state->mutex);
+            if (state->done) {
+                return;
+            }
+            state->done = true;
+            QObject::disconnect(state->connection);
+            locker.unlock();
+
+            if (matched) {
+                if constexpr (!std::is_same<T, void>::value) {
+                    state->fi.reportResult(value.value);
+                }
+                state->fi.reportFinished();
+            }
+        });
+
+        return observable;
+    }
+
+private:
+    QSharedPointer<Private::SignalSource<T>> source;
+
+    SignalObservable<T> pipe(typename Private::SignalOperators<T>::Operator op) const {
+        auto next = QSharedPointer<Private::SignalSource<T>>::create();
+        next->object = source->object;
+        next->connector = Private::SignalOperators<T>::pipe(source->connector, op);
+        return SignalObservable<T>(next);
+    }
+};
+
 template <typename Member>
-auto observe(QObject* object, Member pointToMemberFunction)
--> Observable< typename Private::signal_traits<Member>::result_type> {
+auto observe(QObject* object, Member pointToMemberFunction, ConnectionPolicy connectionPolicy = ConnectionPolicy::Queued)
+-> SignalObservable< typename Private::signal_traits<Member>::result_type> {
 
     typedef typename Private::signal_traits<Member>::result_type RetType;
 
-    auto defer = Private::DeferredFuture<RetType>::create();
+    auto source = QSharedPointer<Private::SignalSource<RetType>>::create();
+    source->object = object;
 
-    auto proxy = new Private::Proxy<RetType>(nullptr);
+    source->observeOnce = [pointToMemberFunction, connectionPolicy](QObject* object) {
+        auto once = std::make_shared<Private::SignalOnce<RetType>>();
+        auto future = once->fi.future();
 
-    QObject::connect(object, &QObject::destroyed, proxy, [=]() {
-       defer->cancel();
-       delete proxy;
-    });
+        // The functor owns the only reference to once. It is released once
+        // the signal is delivered, or together with the connection when the
+        // object is destroyed - then the future is canceled. The context of
+        // the observing thread receives a queued delivery.
+        auto context = Private::threadContext();
+        Private::connectSignal<RetType>(object, pointToMemberFunction, [once](const Private::Value<RetType>& value) {
+            once->complete(value);
+        }, context, Qt::ConnectionType(Private::connectionType(connectionPolicy) | Qt::SingleShotConnection));
 
-    proxy->bind(object, pointToMemberFunction);
-    proxy->callback = [=](Private::Value<RetType> value) {
-        defer->complete(value);
-        delete proxy;
+        return future;
     };
 
-    Observable< typename Private::signal_traits<Member>::result_type> observer(defer->future());
-    return observer;
+    source->connector = [pointToMemberFunction](QObject* object, std::function<void(const Private::Value<RetType>&)> emitter) {
+        return Private::connectSignal<RetType>(object, pointToMemberFunction, emitter);
+    };
+
+    return SignalObservable<RetType>(source);
 }
 
-inline Observable<QVariant> observe(QObject *object,QString signal)  {
+inline Observable<QVariant> observe(QObject *object,QString signal, ConnectionPolicy connectionPolicy = ConnectionPolicy::Queued)  {
 
     auto defer = Private::DeferredFuture<QVariant>::create();
 
@@ -1736,7 +3976,7 @@ inline Observable<QVariant> observe(QObject *object,QString signal)  {
        delete proxy;
     });
 
-    if (proxy->bind(object, signal)) {
+    if (proxy->bind(object, signal, Private::connectionType(connectionPolicy))) {
         proxy->callback = [=](QVariant value) {
             defer->complete(value);
             delete proxy;
@@ -1813,19 +4053,129 @@ QFuture<T> completed(const QList<T> &val) {
     if(!val.isEmpty()) {
         fi.setProgressRange(0, val.size());
         fi.setProgressValue(val.size());
-        fi.reportResults(val.toVector());
+        fi.reportResults(val);
     }
     fi.reportFinished();
     return QFuture<T>(&fi);
 }
 
+template <typename T>
+QFuture<T> completed(QList<T> &&val) {
+    QFuture<T> future = completed<T>(static_cast<const QList<T>&>(val));
+    val = QList<T>();
+    return future;
+}
+
+/* Returns a future that is finished at the deadline. It is completed by the
+ * shared timer thread, so it could be called from any thread and doesn't
+ * create a QTimer. A canceled future is finished at the deadline too.
+ */
+inline QFuture<void> delayUntil(QDeadlineTimer deadline) {
+    QFutureInterface<void> fi;
+    fi.reportStarted();
+
+    Private::TimerService::instance()->arm(deadline, [fi]() mutable {
+        fi.reportFinished();
+    });
+
+    return fi.future();
+}
+
+/// Returns a future that is finished after msec
+inline QFuture<void> delay(int msec) {
+    return delayUntil(QDeadlineTimer(msec, Qt::PreciseTimer));
+}
+
+/* Returns a multi-result future that appends the index of a tick every msec.
+ * It is finished after count ticks (-1 = forever). Cancel the future to stop
+ * it, it is finished at the next tick.
+ */
+inline QFuture<int> interval(int msec, int count = -1) {
+    QFutureInterface<int> fi;
+    fi.reportStarted();
+
+    if (count == 0) {
+        fi.reportFinished();
+    } else {
+        Private::armIntervalTick(fi, QDeadlineTimer::current(Qt::PreciseTimer), qMax(msec, 1), 0, count);
+    }
+
+    return fi.future();
+}
+
+
+/* Call functor(input) for each item of inputs, where the functor returns a
+ * QFuture<R>, and keep at most maxInFlight of those futures running at the
+ * same time. The next input is launched as soon as a running one finishes.
+ *
+ * The returned future holds the result of inputs[i] at index i and reports
+ * the number of finished inputs as its progress. Canceling it cancels the
+ * in-flight futures and skips the pending inputs. If any launched future is
+ * canceled, the returned future is canceled too.
+ *
+ * maxInFlight <= 0 uses QThreadPool::globalInstance()->maxThreadCount().
+ */
+template <typename Sequence, typename Functor>
+auto mapConcurrent(const Sequence& inputs, Functor functor, int maxInFlight = -1)
+-> QFuture<typename Private::future_traits<typename std::invoke_result<Functor&, const typename Sequence::value_type&>::type>::arg_type> {
+    typedef typename Sequence::value_type Input;
+    typedef typename std::invoke_result<Functor&, const Input&>::type FutureType;
+    typedef typename Private::future_traits<FutureType>::arg_type R;
+
+    static_assert(Private::future_traits<FutureType>::is_future, "mapConcurrent(): The functor should return a QFuture");
+
+    auto context = QSharedPointer<Private::MapConcurrent<Input, R>>::create();
+    context->inputs = QList<Input>(std::begin(inputs), std::end(inputs));
+    context->functor = functor;
+    context->defer = Private::DeferredFuture<R>::create();
+    context->launched.resize(context->inputs.size());
+
+    auto defer = context->defer;
+    QFuture<R> future = defer->future();
+
+    defer->setProgressRange(0, context->inputs.size());
+
+    if (context->inputs.isEmpty()) {
+        defer->complete();
+        return future;
+    }
+
+    if (maxInFlight <= 0) {
+        maxInFlight = QThreadPool::globalInstance()->maxThreadCount();
+    }
+
+    const int initialCount = qMin(maxInFlight, static_cast<int>(context->inputs.size()));
+    for (int i = 0 ; i < initialCount ; i++) {
+        Private::MapConcurrent<Input, R>::launch(context);
+    }
+
+    Private::watch(future,
+                   defer.data(),
+                   nullptr,
+                   [](){},
+                   [context]() {
+        context->cancelLaunched();
+    },
+    [](int){},
+    [](int, int){});
+
+    return future;
+}
 
 template<typename T>
-bool waitForFinished(QFuture<T> future, int timeout = -1) {
+bool waitForFinished(QFuture<T> future, int timeout = -1, WaitMode mode = WaitMode::EventLoop) {
     if (future.isFinished()) {
         return true;
     }
 
+    if (mode == WaitMode::Blocking) {
+        if (timeout < 0) {
+            future.waitForFinished();
+            return true;
+        }
+        return Private::blockOn(QList<QFuture<T>>({future}), false, timeout);
+    }
+
     QFutureWatcher<T> watcher;
     QEventLoop loop;
 
@@ -1846,11 +4196,407 @@ bool waitForFinished(QFuture<T> future, int timeout = -1) {
     return watcher.isFinished();
 }
 
-template<typename T>
+/* Block until every future is finished, or timeout msec (-1 waits
+ * forever) has passed. Like WaitMode::Blocking, it does not run an event
+ * loop. Returns false on timeout.
+ */
+template <typename T>
+bool waitAll(const QList<QFuture<T>>& futures, int timeout = -1) {
+    if (timeout < 0) {
+        for (QFuture<T> future : futures) {
+            future.waitForFinished();
+        }
+        return true;
+    }
+
+    return Private::blockOn(futures, false, timeout);
+}
+
+/* Block until any of the futures is finished, and return its index. It
+ * returns -1 if futures is empty or timeout msec (-1 waits forever) has
+ * passed first. It does not run an event loop.
+ */
+template <typename T>
+int waitAny(const QList<QFuture<T>>& futures, int timeout = -1) {
+    if (futures.isEmpty()) {
+        return -1;
+    }
+
+    if (!Private::blockOn(futures, true, timeout)) {
+        return -1;
+    }
+
+    for (int i = 0 ; i < futures.size() ; i++) {
+        if (futures[i].isFinished()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* A fixed size thread pool for fine grained tasks that spawn more tasks.
+ * Each worker has its own deque. A task started from a worker is pushed to
+ * that worker's deque and the worker runs its newest task first, while idle
+ * workers steal the oldest tasks of a random victim. Tasks started from
+ * other threads go through a shared queue, ordered by priority.
+ *
+ * It can be used as the executor of Observable::run(executor, callback).
+ */
+class WorkStealingExecutor {
+public:
+    explicit WorkStealingExecutor(int threadCount = QThread::idealThreadCount()) {
+        const int count = qMax(threadCount, 1);
+        for (int i = 0 ; i < count ; i++) {
+            workers.push_back(std::make_unique<Worker>(quint32(i) * 2654435761u + 1u));
+        }
+        for (int i = 0 ; i < count ; i++) {
+            workers[i]->thread.reset(QThread::create([this, i]() {
+                work(i);
+            }));
+            workers[i]->thread->start();
+        }
+    }
+
+    /// Waits for the queued tasks to finish and stops the workers
+    ~WorkStealingExecutor() {
+        waitForDone();
+        {
+            QMutexLocker<QMutex> locker(&sleepMutex);
+            stopping = true;
+            idle.wakeAll();
+        }
+        for (auto& worker : workers) {
+            worker->thread->wait();
+        }
+    }
+
+    WorkStealingExecutor(const WorkStealingExecutor& other) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor& other) = delete;
+
+    /* Queue a task. From a worker of this executor it is pushed to the
+     * worker's own deque, and priority is ignored. From other threads a
+     * higher priority task is taken before the lower ones.
+     */
+    void start(std::function<void()> task, int priority = 0) {
+        outstanding.fetchAndAddOrdered(1);
+
+        const int index = currentWorker();
+        if (index >= 0) {
+            Worker& worker = *workers[index];
+            QMutexLocker<QMutex> locker(&worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        } else {
+            QMutexLocker<QMutex> locker(&injectedMutex);
+            auto pos = std::find_if(injected.begin(), injected.end(), [priority](const Injected& item) {
+                return item.priority < priority;
+            });
+            injected.insert(pos, Injected{std::move(task), priority});
+        }
+
+        queued.fetchAndAddOrdered(1);
+        if (sleepers.loadAcquire() > 0) {
+            QMutexLocker<QMutex> locker(&sleepMutex);
+            idle.wakeOne();
+        }
+    }
+
+    /// Run functor on the executor and return a future of its result.
+    template <typename Functor>
+    auto run(Functor functor) -> QFuture<typename std::invoke_result<Functor&>::type> {
+        typedef typename std::invoke_result<Functor&>::type R;
+        auto promise = std::make_shared<QPromise<R>>();
+        QFuture<R> future = promise->future();
+        promise->start();
+
+        start([promise, functor]() mutable {
+            if (promise->isCanceled()) {
+                promise->finish();
+                return;
+            }
+            try {
+                if constexpr (std::is_same<R, void>::value) {
+                    functor();
+                } else {
+                    promise->addResult(functor());
+                }
+            } catch (QException& e) {
+                promise->setException(e);
+            } catch (...) {
+                promise->setException(std::current_exception());
+            }
+            promise->finish();
+        });
+
+        return future;
+    }
+
+    /// Wait until every started task has finished. Returns false on timeout.
+    bool waitForDone(int msecs = -1) {
+        QDeadlineTimer deadline(msecs < 0 ? QDeadlineTimer(QDeadlineTimer::Forever) : QDeadlineTimer(msecs));
+        QMutexLocker<QMutex> locker(&doneMutex);
+        while (outstanding.loadAcquire() > 0) {
+            if (!done.wait(&doneMutex, deadline)) {
+                return outstanding.loadAcquire() == 0;
+            }
+        }
+        return true;
+    }
+
+    int threadCount() const {
+        return int(workers.size());
+    }
+
+private:
+    class Worker {
+    public:
+        explicit Worker(quint32 seed) : seed(seed) {
+        }
+
+        QMutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::unique_ptr<QThread> thread;
+        quint32 seed;
+    };
+
+    class Injected {
+    public:
+        std::function<void()> task;
+        int priority;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    QMutex injectedMutex;
+    std::deque<Injected> injected;
+
+    QAtomicInt queued;
+    QAtomicInt outstanding;
+    QAtomicInt sleepers;
+    QMutex sleepMutex;
+    QWaitCondition idle;
+    bool stopping = false;
+
+    QMutex doneMutex;
+    QWaitCondition done;
+
+    class Current {
+    public:
+        const WorkStealingExecutor* executor = nullptr;
+        int index = -1;
+    };
+
+    static Current& current() {
+        static thread_local Current value;
+        return value;
+    }
+
+    int currentWorker() const {
+        const Current& value = current();
+        return value.executor == this ? value.index : -1;
+    }
+
+    bool take(int index, std::function<void()>& task) {
+        // Own tasks, newest first
+        {
+            Worker& worker = *workers[index];
+            QMutexLocker<QMutex> locker(&worker.mutex);
+            if (!worker.tasks.empty()) {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+                return true;
+            }
+        }
+
+        {
+            QMutexLocker<QMutex> locker(&injectedMutex);
+            if (!injected.empty()) {
+                task = std::move(injected.front().task);
+                injected.pop_front();
+                return true;
+            }
+        }
+
+        // Steal the oldest task of a random victim
+        const int count = int(workers.size());
+        Worker& self = *workers[index];
+        for (int attempt = 0 ; attempt < count - 1 ; attempt++) {
+            self.seed ^= self.seed << 13;
+            self.seed ^= self.seed >> 17;
+            self.seed ^= self.seed << 5;
+            const int victimIndex = int(self.seed % quint32(count));
+            if (victimIndex == index) {
+                continue;
+            }
+            Worker& victim = *workers[victimIndex];
+            QMutexLocker<QMutex> locker(&victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        // Sweep all workers once before going to sleep
+        for (int i = 0 ; i < count ; i++) {
+            Worker& victim = *workers[i];
+            QMutexLocker<QMutex> locker(&victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void work(int index) {
+        current().executor = this;
+        current().index = index;
+
+        std::function<void()> task;
+        while (true) {
+            if (take(index, task)) {
+                queued.fetchAndSubOrdered(1);
+                try {
+                    task();
+                } catch (...) {
+                    // A task must not stop the worker
+                }
+                task = nullptr;
+
+                if (outstanding.fetchAndSubOrdered(1) == 1) {
+                    QMutexLocker<QMutex> locker(&doneMutex);
+                    done.wakeAll();
+                }
+                continue;
+            }
+
+            QMutexLocker<QMutex> locker(&sleepMutex);
+            sleepers.fetchAndAddOrdered(1);
+            if (queued.loadAcquire() <= 0) {
+                if (stopping) {
+                    sleepers.fetchAndSubOrdered(1);
+                    break;
+                }
+                idle.wait(&sleepMutex);
+            }
+            sleepers.fetchAndSubOrdered(1);
+        }
+
+        current() = Current();
+    }
+};
+
+template<typename T, typename Key>
+class Restarter;
+
+/* Passed to the run function of Restarter::restart(runFunction(state)) so
+ * an incremental job can reuse earlier work. previous() is the future of
+ * the last run that completed. checkpoint() is the partial state that an
+ * earlier run published with publish() before it was canceled or
+ * superseded. publish() may be called from the worker thread.
+ */
+template <typename T>
+class RestartState {
+public:
+    QFuture<T> previous() const {
+        return previousFuture;
+    }
+
+    bool hasCheckpoint() const {
+        return handedCheckpoint.has_value();
+    }
+
+    /// The published checkpoint, or C() if there is none of type C.
+    template <typename C>
+    C checkpoint() const {
+        const C* value = std::any_cast<C>(&handedCheckpoint);
+        return value != nullptr ? *value : C();
+    }
+
+    /// Publish partial state for the run that replaces this one.
+    template <typename C>
+    void publish(C value) const {
+        QMutexLocker<QMutex> locker(&slot->mutex);
+        slot->value = std::move(value);
+    }
+
+private:
+    class Slot {
+    public:
+        QMutex mutex;
+        std::any value;
+
+        std::any load() {
+            QMutexLocker<QMutex> locker(&mutex);
+            return value;
+        }
+    };
+
+    QFuture<T> previousFuture;
+    std::any handedCheckpoint;
+    QSharedPointer<Slot> slot = QSharedPointer<Slot>::create();
+
+    template<typename, typename>
+    friend class Restarter;
+};
+
+/* What Restarter::restart() does with a job that is still running.
+ * CancelImmediately cancels it. FinishIfNearlyDone lets it finish and
+ * deliver its result when its progress has reached the threshold, and then
+ * starts the latest request. RunBothKeepNewest starts the new run next to
+ * it and ignores the result of the older one. An even older run is
+ * canceled then, so at most two runs are in flight.
+ */
+enum class PreemptionPolicy {
+    CancelImmediately,
+    FinishIfNearlyDone,
+    RunBothKeepNewest
+};
+
+/* Counters kept by Restarter. A run is counted as canceled when it was
+ * canceled or superseded by a newer restart(), and its wall time is added
+ * to canceledNSecs. Only runs that complete the outer future count as
+ * completed and add to deliveredNSecs.
+ */
+class RestarterMetrics {
+public:
+    int restartsRequested = 0;
+    int runsStarted = 0;
+    int runsCanceled = 0;
+    int runsCompleted = 0;
+    int cacheHits = 0;
+    qint64 canceledNSecs = 0;
+    qint64 deliveredNSecs = 0;
+
+    /// The share of the run time spent in runs that were thrown away.
+    double wastedRatio() const {
+        const qint64 total = canceledNSecs + deliveredNSecs;
+        return total > 0 ? double(canceledNSecs) / double(total) : 0.0;
+    }
+};
+
+inline QDebug operator<<(QDebug debug, const RestarterMetrics& metrics) {
+    QDebugStateSaver saver(debug);
+    debug.nospace() << "RestarterMetrics(requested=" << metrics.restartsRequested
+                    << ", started=" << metrics.runsStarted
+                    << ", canceled=" << metrics.runsCanceled
+                    << ", completed=" << metrics.runsCompleted
+                    << ", cacheHits=" << metrics.cacheHits
+                    << ", canceledMsecs=" << metrics.canceledNSecs / 1000000
+                    << ", deliveredMsecs=" << metrics.deliveredNSecs / 1000000
+                    << ")";
+    return debug;
+}
+
+template<typename T, typename Key = QString>
 class Restarter {
 public:
+    typedef AsyncFuture::RestartState<T> RestartState;
+
     Restarter(QObject* context) :
-        context(context)
+        context(context),
+        timerTarget(Private::PostTarget::create(context ? context : QCoreApplication::instance()))
     {
         //This prevents deadlock if future() is used and waiting for it before restart() is called
         outerDeferred.cancel();
@@ -1859,23 +4605,33 @@ public:
             onDestoryContext = QObject::connect(context, &QObject::destroyed, context, [this]() {
                 // Context is gone, cancel any in-flight work and resolve outer deferred
                 isCancelling = false;
+                isFinishing = false;
                 isQueuedStart = false;
                 if (activeInner.isRunning()) {
                     activeInner.cancel();
                 }
+                if (supersededInner.isRunning()) {
+                    supersededInner.cancel();
+                }
                 if (!outerDeferred.future().isFinished()) {
                     outerDeferred.cancel();
                 }
                 pendingStart = nullptr;
+                disarmDelayedStart();
             });
         }
     }
     ~Restarter() {
         *m_alive = false;
+        timerTarget->close();
+        disarmDelayedStart();
         QObject::disconnect(onDestoryContext);
         if (activeInner.isRunning()) {
             activeInner.cancel();
         }
+        if (supersededInner.isRunning()) {
+            supersededInner.cancel();
+        }
         if (!outerDeferred.future().isFinished()) {
             outerDeferred.cancel();
         }
@@ -1885,25 +4641,85 @@ public:
     Restarter& operator=(const Restarter& other) = delete;
 
 
+    /* Restart with a keyed input. If a run with an equal key has completed
+     * recently and is still in the result cache, the outer future completes
+     * immediately with that result and no worker is launched. Otherwise it
+     * behaves like restart(runFunction), and the result is cached under key.
+     */
+    void restart(const Key& key, std::function<QFuture<T> ()> runFunction) {
+        Q_ASSERT(runFunction);
+
+        CacheEntry* entry = resultCache.object(key);
+        if (entry != nullptr && entry->expiry.hasExpired()) {
+            resultCache.remove(key);
+            entry = nullptr;
+        }
+
+        if (entry == nullptr) {
+            restart(std::move(runFunction));
+            runKey = key;
+            return;
+        }
+
+        stats.restartsRequested++;
+        stats.cacheHits++;
+        deliverCached(entry->future);
+    }
+
+    /// The number of results kept for restart(key, runFunction). 0 disables the cache.
+    void setCacheSize(int entries) {
+        resultCache.setMaxCost(qMax(entries, 0));
+    }
+
+    int cacheSize() const {
+        return int(resultCache.maxCost());
+    }
+
+    /// How long a cached result is used. -1 keeps it until it is evicted by newer entries.
+    void setCacheTtl(int msec) {
+        cacheTtlMsec = msec;
+    }
+
+    int cacheTtl() const {
+        return cacheTtlMsec;
+    }
+
+    void clearCache() {
+        resultCache.clear();
+    }
+
     void restart(std::function<QFuture<T> ()> runFunction) {
         Q_ASSERT(runFunction);
 
+        runKey.reset();
         currentRunFunction = std::move(runFunction);
         generation++;
+        stats.restartsRequested++;
+        lastRequestNSecs = nowNSecs();
+
+        const bool runBoth = preemption == PreemptionPolicy::RunBothKeepNewest && !isCancelling && !isFinishing;
 
-        if(!activeInner.isRunning()) {
+        if(!activeInner.isRunning() || runBoth) {
             // Queue the first start of a burst on the event loop so that rapid
             // synchronous restart() calls coalesce into a single run.
             if(!isQueuedStart) {
                 isQueuedStart = true;
-                outerDeferred = AsyncFuture::deferred<T>();
-                fireFutureChanged();
+                if (!activeInner.isRunning() || outerDeferred.future().isFinished()) {
+                    outerDeferred = AsyncFuture::deferred<T>();
+                    fireFutureChanged();
+                }
                 auto alive = m_alive;
-                if (context) {
+                if (startDelayNSecs() > 0) {
+                    armDelayedStart();
+                } else if (context) {
                     QMetaObject::invokeMethod(context, [this, alive]() {
                         if (!*alive) {
                             return;
                         }
+                        if (!isQueuedStart) {
+                            // Superseded by a cached result
+                            return;
+                        }
                         isQueuedStart = false;
                         startRun();
                     }, Qt::QueuedConnection);
@@ -1913,12 +4729,37 @@ public:
                 }
             }
             // else: already queued for this burst; currentRunFunction is updated
-            // above and startRun() will use it when the queued call fires.
+            // above and startRun() will use it when the queued call fires. A
+            // delayed start checks lastRequestNSecs again when its timer fires.
+        } else if (!isCancelling && !isFinishing && preemption == PreemptionPolicy::FinishIfNearlyDone &&
+                   progressOf(activeInner) >= preemptionThreshold) {
+            // Let the running job deliver its result, then deliver() starts
+            // the latest request with a new outer future.
+            isFinishing = true;
+            pendingStart = [this]() {
+                if (outerDeferred.future().isFinished()) {
+                    outerDeferred = AsyncFuture::deferred<T>();
+                    fireFutureChanged();
+                }
+                if (startDelayNSecs() > 0) {
+                    isQueuedStart = true;
+                    armDelayedStart();
+                } else {
+                    startRun();
+                }
+            };
         } else {
             //Only setup the watch and cancel the future once
-            if(!isCancelling) {
+            if(!isCancelling && !isFinishing) {
                 isCancelling = true;
-                pendingStart = [this]() { startRun(); };
+                pendingStart = [this]() {
+                    if (startDelayNSecs() > 0) {
+                        isQueuedStart = true;
+                        armDelayedStart();
+                    } else {
+                        startRun();
+                    }
+                };
 
                 // If the outer future has already settled (typically because
                 // the user called restarter.future().cancel()), start a fresh
@@ -1955,6 +4796,55 @@ public:
         }
     }
 
+    /* Restart with a run function that receives a RestartState, so an
+     * incremental algorithm can continue from the last completed result or
+     * from the checkpoint published by the run that was canceled.
+     */
+    void restart(std::function<QFuture<T> (const RestartState&)> runFunction) {
+        Q_ASSERT(runFunction);
+        restart([this, runFunction]() {
+            return runFunction(nextRestartState());
+        });
+    }
+
+    /* Wait until restart() has not been called for msec before a run is
+     * started, so a burst of requests (e.g. keystrokes) starts one run.
+     * A running job is still canceled immediately. 0 disables it.
+     */
+    void setDebounce(int msec) {
+        debounceMsec = qMax(msec, 0);
+    }
+
+    int debounce() const {
+        return debounceMsec;
+    }
+
+    /// Start runs at most once per msec. 0 disables it.
+    void setMinInterval(int msec) {
+        minIntervalMsec = qMax(msec, 0);
+    }
+
+    int minInterval() const {
+        return minIntervalMsec;
+    }
+
+    /* Choose what restart() does with a running job. progressThreshold is
+     * the fraction of the progress range used by FinishIfNearlyDone. A job
+     * that reports no progress range is always canceled by it.
+     */
+    void setPreemptionPolicy(PreemptionPolicy policy, double progressThreshold = 0.9) {
+        preemption = policy;
+        preemptionThreshold = progressThreshold;
+    }
+
+    PreemptionPolicy preemptionPolicy() const {
+        return preemption;
+    }
+
+    double preemptionProgressThreshold() const {
+        return preemptionThreshold;
+    }
+
     void onFutureChanged(std::function<void ()> changedCallback) {
         this->changedCallback = changedCallback;
     }
@@ -2004,6 +4894,15 @@ public:
         return outerDeferred.future();
     }
 
+    /// Counters since construction or the last resetMetrics(). Use it to tune setDebounce() / setMinInterval().
+    RestarterMetrics metrics() const {
+        return stats;
+    }
+
+    void resetMetrics() {
+        stats = RestarterMetrics();
+    }
+
 private:
     std::shared_ptr<bool> m_alive = std::make_shared<bool>(true);
     std::function<QFuture<T> ()> currentRunFunction;
@@ -2011,12 +4910,147 @@ private:
     std::function<void ()> resultCallback;
     std::function<void()> pendingStart;
     QFuture<T> activeInner;
+    // The older run kept by RunBothKeepNewest
+    QFuture<T> supersededInner;
     Deferred<T> outerDeferred;
     QObject* context;
+    // Where the TimerService callbacks are posted to
+    std::shared_ptr<Private::PostTarget> timerTarget;
     QMetaObject::Connection onDestoryContext;
     int generation = 0;
     bool isCancelling = false;
+    bool isFinishing = false;
     bool isQueuedStart = false;
+    int activeGeneration = 0;
+    PreemptionPolicy preemption = PreemptionPolicy::CancelImmediately;
+    double preemptionThreshold = 0.9;
+    int debounceMsec = 0;
+    int minIntervalMsec = 0;
+
+    class CacheEntry {
+    public:
+        QFuture<T> future;
+        QDeadlineTimer expiry;
+    };
+
+    QCache<Key, CacheEntry> resultCache{16};
+    int cacheTtlMsec = -1;
+    std::optional<Key> runKey;
+    RestarterMetrics stats;
+    QFuture<T> lastCompleted;
+    QSharedPointer<typename RestartState::Slot> checkpointSlot;
+    qint64 lastRequestNSecs = 0;
+    qint64 lastStartNSecs = std::numeric_limits<qint64>::min();
+    Private::TimerService::TimerId startTimerId = 0;
+
+    static qint64 nowNSecs() {
+        return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    }
+
+    // A checkpoint is handed to the next run until a run completes
+    RestartState nextRestartState() {
+        RestartState state;
+        state.previousFuture = lastCompleted;
+        if (checkpointSlot) {
+            state.handedCheckpoint = checkpointSlot->load();
+            state.slot->value = state.handedCheckpoint;
+        }
+        checkpointSlot = state.slot;
+        return state;
+    }
+
+    static double progressOf(const QFuture<T>& future) {
+        const int range = future.progressMaximum() - future.progressMinimum();
+        if (range <= 0) {
+            return 0;
+        }
+        return double(future.progressValue() - future.progressMinimum()) / range;
+    }
+
+    // How long the next run should wait for the debounce and the minimum interval
+    qint64 startDelayNSecs() const {
+        const qint64 msec = 1000 * 1000;
+        qint64 due = lastRequestNSecs + debounceMsec * msec;
+        if (minIntervalMsec > 0 && lastStartNSecs != std::numeric_limits<qint64>::min()) {
+            due = qMax(due, lastStartNSecs + minIntervalMsec * msec);
+        }
+        return due - nowNSecs();
+    }
+
+    // The timer fires on the TimerService thread. It only posts the start to
+    // the context's thread (or the main thread) through timerTarget, which is
+    // closed by the destructor, and the Restarter is used after the alive check.
+    void armDelayedStart() {
+        disarmDelayedStart();
+
+        auto alive = m_alive;
+        auto start = [this, alive]() {
+            if (!*alive) {
+                return;
+            }
+            startTimerId = 0;
+            if (!isQueuedStart) {
+                return;
+            }
+            if (startDelayNSecs() > 0) {
+                // restart() was called again meanwhile
+                armDelayedStart();
+                return;
+            }
+            isQueuedStart = false;
+            startRun();
+        };
+
+        auto target = timerTarget;
+        QDeadlineTimer deadline(std::chrono::nanoseconds(qMax<qint64>(startDelayNSecs(), 0)), Qt::PreciseTimer);
+
+        startTimerId = Private::TimerService::instance()->arm(deadline, [target, start]() {
+            target->post(start);
+        });
+    }
+
+    // Complete the current logical run with a cached result, superseding any
+    // pending or running worker.
+    void deliverCached(QFuture<T> cached) {
+        generation++;
+        runKey.reset();
+        isQueuedStart = false;
+        isCancelling = false;
+        isFinishing = false;
+        pendingStart = nullptr;
+        disarmDelayedStart();
+
+        if (activeInner.isRunning()) {
+            activeInner.cancel();
+        }
+        if (supersededInner.isRunning()) {
+            supersededInner.cancel();
+        }
+        lastCompleted = cached;
+        checkpointSlot.reset();
+
+        if (outerDeferred.future().isFinished()) {
+            outerDeferred = AsyncFuture::deferred<T>();
+            fireFutureChanged();
+        }
+
+        if constexpr (std::is_same_v<T, void>) {
+            outerDeferred.complete();
+        } else {
+            if (cached.resultCount() == 0) {
+                outerDeferred.complete();
+            } else {
+                outerDeferred.complete(cached.result());
+            }
+        }
+    }
+
+    void disarmDelayedStart() {
+        if (startTimerId != 0) {
+            Private::TimerService::instance()->disarm(startTimerId);
+            startTimerId = 0;
+        }
+    }
 
     // Fires the consumer hooks that must run whenever a fresh outerDeferred is
     // installed: the onFutureChanged() callback (future() now points at a new
@@ -2032,6 +5066,22 @@ private:
     }
 
     void startRun() {
+        lastStartNSecs = nowNSecs();
+        stats.runsStarted++;
+        activeGeneration = generation;
+        isCancelling = false;
+
+        // RunBothKeepNewest keeps only the run that the new one supersedes.
+        // An older run is canceled, so at most two run at the same time.
+        if (supersededInner.isRunning()) {
+            supersededInner.cancel();
+        }
+        if (preemption == PreemptionPolicy::RunBothKeepNewest && activeInner.isRunning()) {
+            supersededInner = activeInner;
+        } else {
+            supersededInner = QFuture<T>();
+        }
+
         QFuture<T> inner = currentRunFunction();
 
         outerDeferred.track(inner);
@@ -2040,11 +5090,11 @@ private:
         // when no context was provided.
         QObject* observeContext = context ? context : QCoreApplication::instance();
         AsyncFuture::observe(inner).context(observeContext,
-                                            [this, gen = generation, inner]() {
-                                                deliver(gen, inner);
+                                            [this, gen = generation, inner, started = lastStartNSecs]() {
+                                                deliver(gen, inner, started);
                                             },
-                                            [this, gen = generation, inner]() {
-                                                deliver(gen, inner);
+                                            [this, gen = generation, inner, started = lastStartNSecs]() {
+                                                deliver(gen, inner, started);
                                             });
 
         // Push cancel from the outer future down to the inner. Without this,
@@ -2065,18 +5115,39 @@ private:
         activeInner = inner;
     }
 
-    void deliver(int gen, const QFuture<T>& future) {
-        isCancelling = false;
-        activeInner = future;
+    void deliver(int gen, const QFuture<T>& future, qint64 startedNSecs) {
+        // With RunBothKeepNewest an older run may finish after a newer one started
+        if (gen == activeGeneration) {
+            isCancelling = false;
+            activeInner = future;
+        }
+
+        const bool finishing = isFinishing && gen == activeGeneration;
+
+        const qint64 elapsed = nowNSecs() - startedNSecs;
+        if ((gen != generation && !finishing) || future.isCanceled()) {
+            stats.runsCanceled++;
+            stats.canceledNSecs += elapsed;
+        } else {
+            stats.runsCompleted++;
+            stats.deliveredNSecs += elapsed;
+        }
 
         // Ignore stale completions
-        if(gen != generation) {
+        if(gen != generation && !finishing) {
             return;
         }
 
         if(future.isCanceled()) {
             outerDeferred.cancel();
         } else {
+            lastCompleted = future;
+            checkpointSlot.reset();
+
+            if (!finishing && runKey.has_value() && resultCache.maxCost() > 0) {
+                resultCache.insert(*runKey, new CacheEntry{future, QDeadlineTimer(cacheTtlMsec)});
+            }
+
             if constexpr (std::is_same_v<T, void>) {
                 outerDeferred.complete();
             } else {
@@ -2094,6 +5165,16 @@ private:
             }
         }
 
+        // FinishIfNearlyDone: the latest request starts after this result
+        if (finishing) {
+            isFinishing = false;
+            if (pendingStart) {
+                auto start = pendingStart;
+                pendingStart = nullptr;
+                start();
+            }
+        }
+
         // Do NOT fire changedCallback() here. onFutureChanged means "future()
         // now points to a NEW future" — it is fired only where a fresh
         // outerDeferred is installed (the two restart() paths). Completing the
@@ -2104,4 +5185,391 @@ private:
         // so the continuation runs twice for one logical run.
     }
 };
+
+/* Restart/coalesce semantics for many independent keys (e.g. one job per
+ * document tab or per tile) with shared bookkeeping.
+ *
+ * restart(key, runFunction) behaves like Restarter::restart() for that key:
+ * the calls made within one event loop turn are coalesced, and a running
+ * job of the same key is canceled. At most maxConcurrent() runs are active
+ * at the same time, and a canceled run stays active until its future is
+ * finished. The other keys wait in a queue, and the most recently
+ * requested key is started first. Keys that have been idle for
+ * idleTimeout() msec are removed.
+ *
+ * Like Restarter, it must be used from the context's thread.
+ */
+template <typename Key, typename T>
+class RestarterMap {
+public:
+    explicit RestarterMap(QObject* context, int maxConcurrent = -1) :
+        context(context),
+        timerTarget(Private::PostTarget::create(context ? context : QCoreApplication::instance()))
+    {
+        setMaxConcurrent(maxConcurrent);
+
+        if (context) {
+            onDestroyContext = QObject::connect(context, &QObject::destroyed, context, [this]() {
+                cancelAll();
+                this->context = nullptr;
+            });
+        }
+    }
+
+    ~RestarterMap() {
+        *m_alive = false;
+        timerTarget->close();
+        disarmEviction();
+        QObject::disconnect(onDestroyContext);
+        cancelAll();
+    }
+
+    RestarterMap(const RestarterMap& other) = delete;
+    RestarterMap& operator=(const RestarterMap& other) = delete;
+
+    /// Restart the job of key and return the future that receives its next result.
+    QFuture<T> restart(const Key& key, std::function<QFuture<T> ()> runFunction) {
+        Q_ASSERT(runFunction);
+
+        Entry& entry = entries[key];
+        entry.runFunction = std::move(runFunction);
+        entry.generation++;
+
+        if (entry.isRunning) {
+            // Its slot is released once the canceled run is finished
+            entry.isRunning = false;
+            if (entry.activeInner.isRunning()) {
+                entry.activeInner.cancel();
+            }
+        }
+
+        if (entry.queuedSequence != 0) {
+            queue.erase(entry.queuedSequence);
+        }
+        entry.queuedSequence = ++lastSequence;
+        queue.emplace(entry.queuedSequence, key);
+
+        QFuture<T> future;
+        if (entry.outerSerial == 0 || entry.outer.future().isFinished()) {
+            entry.outer = Deferred<T>();
+            entry.outerSerial++;
+            future = entry.outer.future();
+            watchOuter(key, entry.outerSerial, future);
+        } else {
+            future = entry.outer.future();
+        }
+
+        scheduleDispatch();
+        return future;
+    }
+
+    /// The future of the latest request of key. An unknown key gives a canceled future.
+    QFuture<T> future(const Key& key) const {
+        auto it = entries.constFind(key);
+        if (it == entries.constEnd()) {
+            return QFuture<T>();
+        }
+        return it->outer.future();
+    }
+
+    /// Cancel the queued or running job of key.
+    void cancel(const Key& key) {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return;
+        }
+        Deferred<T> outer = it->outer;
+        release(key);
+        outer.cancel();
+    }
+
+    bool contains(const Key& key) const {
+        return entries.contains(key);
+    }
+
+    /// The number of keys tracked, including idle ones that are not evicted yet.
+    int size() const {
+        return int(entries.size());
+    }
+
+    /// The number of runs holding a slot, including canceled ones that are not finished yet.
+    int runningCount() const {
+        return activeRuns;
+    }
+
+    int queuedCount() const {
+        return int(queue.size());
+    }
+
+    /// The maximum number of concurrent runs. <= 0 uses QThreadPool::globalInstance()->maxThreadCount().
+    void setMaxConcurrent(int count) {
+        maxRuns = count > 0 ? count : QThreadPool::globalInstance()->maxThreadCount();
+        scheduleDispatch();
+    }
+
+    int maxConcurrent() const {
+        return maxRuns;
+    }
+
+    /// How long a finished key is kept. -1 keeps keys until the map is destroyed.
+    void setIdleTimeout(int msec) {
+        idleTimeoutMsec = msec;
+        disarmEviction();
+        scheduleEviction();
+    }
+
+    int idleTimeout() const {
+        return idleTimeoutMsec;
+    }
+
+private:
+    class Entry {
+    public:
+        std::function<QFuture<T> ()> runFunction;
+        Deferred<T> outer;
+        QFuture<T> activeInner;
+        int generation = 0;
+        int outerSerial = 0;
+        qint64 queuedSequence = 0;
+        qint64 lastUsedNSecs = 0;
+        bool isRunning = false;
+    };
+
+    std::shared_ptr<bool> m_alive = std::make_shared<bool>(true);
+    QObject* context;
+    // Where the TimerService callbacks are posted to
+    std::shared_ptr<Private::PostTarget> timerTarget;
+    QMetaObject::Connection onDestroyContext;
+    QHash<Key, Entry> entries;
+    std::map<qint64, Key> queue;
+    qint64 lastSequence = 0;
+    int activeRuns = 0;
+    int maxRuns = 1;
+    int idleTimeoutMsec = 60000;
+    bool isDispatchQueued = false;
+    Private::TimerService::TimerId evictionTimerId = 0;
+
+    static qint64 nowNSecs() {
+        return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    }
+
+    QObject* target() const {
+        return context ? context : QCoreApplication::instance();
+    }
+
+    // Canceling the returned future drops the key from the queue, or cancels its run
+    void watchOuter(const Key& key, int serial, QFuture<T> future) {
+        auto alive = m_alive;
+        AsyncFuture::observe(future).context(target(),
+                                             [](){},
+                                             [this, alive, key, serial]() {
+            if (!*alive) {
+                return;
+            }
+            auto it = entries.find(key);
+            if (it != entries.end() && it->outerSerial == serial) {
+                release(key);
+            }
+        });
+    }
+
+    // Drop the queued or running job of key and mark it idle
+    void release(const Key& key) {
+        auto it = entries.find(key);
+        it->generation++;
+        if (it->queuedSequence != 0) {
+            queue.erase(it->queuedSequence);
+            it->queuedSequence = 0;
+        }
+        if (it->isRunning) {
+            it->isRunning = false;
+            if (it->activeInner.isRunning()) {
+                it->activeInner.cancel();
+            }
+        }
+        it->lastUsedNSecs = nowNSecs();
+        scheduleEviction();
+    }
+
+    // The canceled runs keep their slots until their futures are finished,
+    // then holdSlot() releases them.
+    void cancelAll() {
+        disarmEviction();
+        queue.clear();
+        QHash<Key, Entry> removed;
+        removed.swap(entries);
+        for (auto it = removed.begin(); it != removed.end(); ++it) {
+            if (it->activeInner.isRunning()) {
+                it->activeInner.cancel();
+            }
+            if (!it->outer.future().isFinished()) {
+                it->outer.cancel();
+            }
+        }
+    }
+
+    void scheduleDispatch() {
+        if (isDispatchQueued || queue.empty() || activeRuns >= maxRuns) {
+            return;
+        }
+        QObject* receiver = target();
+        if (receiver == nullptr) {
+            return;
+        }
+        isDispatchQueued = true;
+        auto alive = m_alive;
+        QMetaObject::invokeMethod(receiver, [this, alive]() {
+            if (!*alive) {
+                return;
+            }
+            isDispatchQueued = false;
+            dispatch();
+        }, Qt::QueuedConnection);
+    }
+
+    // Start the most recently requested keys until the cap is reached
+    void dispatch() {
+        while (!queue.empty() && activeRuns < maxRuns) {
+            auto last = std::prev(queue.end());
+            Key key = last->second;
+            queue.erase(last);
+
+            auto it = entries.find(key);
+            if (it == entries.end()) {
+                continue;
+            }
+            it->queuedSequence = 0;
+            startRun(key, *it);
+        }
+    }
+
+    void startRun(const Key& key, Entry& entry) {
+        const int gen = entry.generation;
+        Deferred<T> outer = entry.outer;
+        std::function<QFuture<T> ()> runFunction = entry.runFunction;
+        entry.isRunning = true;
+        activeRuns++;
+
+        // runFunction may call restart() and rehash the entries
+        QFuture<T> inner = runFunction();
+        holdSlot(inner);
+
+        auto it = entries.find(key);
+        if (it == entries.end() || it->generation != gen) {
+            inner.cancel();
+            return;
+        }
+        it->activeInner = inner;
+        outer.track(inner);
+
+        auto alive = m_alive;
+        AsyncFuture::observe(inner).context(target(),
+                                            [this, alive, key, gen, inner]() {
+                                                if (*alive) {
+                                                    deliver(key, gen, inner);
+                                                }
+                                            },
+                                            [this, alive, key, gen, inner]() {
+                                                if (*alive) {
+                                                    deliver(key, gen, inner);
+                                                }
+                                            });
+    }
+
+    // A run holds its slot until its future is finished, even after it is
+    // canceled, so a canceled worker that is still executing counts against
+    // maxConcurrent(). The watcher lives in this thread.
+    void holdSlot(QFuture<T> inner) {
+        auto alive = m_alive;
+        auto watcher = new QFutureWatcher<T>();
+        QObject::connect(watcher, &QFutureWatcher<T>::finished, watcher, [this, alive, watcher]() {
+            watcher->disconnect();
+            watcher->deleteLater();
+            if (!*alive || activeRuns == 0) {
+                return;
+            }
+            activeRuns--;
+            scheduleDispatch();
+        });
+        watcher->setFuture(inner);
+    }
+
+    void deliver(const Key& key, int gen, const QFuture<T>& future) {
+        auto it = entries.find(key);
+        if (it == entries.end() || it->generation != gen || !it->isRunning) {
+            // Superseded, and its slot has been released already
+            return;
+        }
+
+        it->isRunning = false;
+        it->activeInner = QFuture<T>();
+        it->lastUsedNSecs = nowNSecs();
+
+        Deferred<T> outer = it->outer;
+        if (future.isCanceled()) {
+            outer.cancel();
+        } else {
+            if constexpr (std::is_same_v<T, void>) {
+                outer.complete();
+            } else {
+                if (future.resultCount() == 0) {
+                    outer.complete();
+                } else {
+                    outer.complete(future.result());
+                }
+            }
+        }
+
+        scheduleEviction();
+    }
+
+    // The timer fires on the TimerService thread and only posts the eviction
+    // to the context's thread through timerTarget, which the destructor closes
+    void scheduleEviction() {
+        if (idleTimeoutMsec < 0 || evictionTimerId != 0) {
+            return;
+        }
+
+        auto alive = m_alive;
+        auto evict = [this, alive]() {
+            if (!*alive) {
+                return;
+            }
+            evictionTimerId = 0;
+            evictIdle();
+        };
+
+        auto target = timerTarget;
+        evictionTimerId = Private::TimerService::instance()->arm(QDeadlineTimer(idleTimeoutMsec), [target, evict]() {
+            target->post(evict);
+        });
+    }
+
+    void disarmEviction() {
+        if (evictionTimerId != 0) {
+            Private::TimerService::instance()->disarm(evictionTimerId);
+            evictionTimerId = 0;
+        }
+    }
+
+    void evictIdle() {
+        const qint64 now = nowNSecs();
+        const qint64 timeout = qint64(idleTimeoutMsec) * 1000 * 1000;
+        bool hasIdle = false;
+
+        for (auto it = entries.begin(); it != entries.end();) {
+            const bool idle = !it->isRunning && it->queuedSequence == 0;
+            if (idle && now - it->lastUsedNSecs >= timeout) {
+                it = entries.erase(it);
+            } else {
+                hasIdle = hasIdle || idle;
+                ++it;
+            }
+        }
+
+        if (hasIdle) {
+            scheduleEviction();
+        }
+    }
+};
 }
@@ -0,0 +1,195 @@
+#include <QTest>
+#include <vector>
+#include <asyncfuture.h>
+#include "benchmarks.h"
+
+using namespace AsyncFuture;
+
+Benchmarks::Benchmarks(QObject *parent) : QObject(parent)
+{
+    // This function do nothing but could make Qt Creator Autotests plugin recognize this test
+    auto ref =[this]() {
+        QTest::qExec(this, 0, 0);
+    };
+    Q_UNUSED(ref);
+}
+
+// Observations per iteration. Direct delivery keeps the event loop out of the measurement.
+static const int ObservationCount = 1000;
+
+// The observation of a member signal before it used single shot functor
+// connections: a proxy QObject per observation, whose qt_metacall completes
+// a DeferredFuture, and a destroyed connection. It is the removed
+// Private::Proxy reduced to the int signal of BenchmarkEmitter.
+class LegacyProxy : public QObject
+{
+public:
+    std::function<void(int)> callback;
+    QMetaObject::Connection conn;
+    QPointer<QObject> sender;
+
+    void bind(QObject* source, int signalIndex, Qt::ConnectionType type) {
+        sender = source;
+        conn = QMetaObject::connect(source, signalIndex, this, QObject::staticMetaObject.methodCount(), type, nullptr);
+    }
+
+    int qt_metacall(QMetaObject::Call call, int id, void** args) override {
+        id = QObject::qt_metacall(call, id, args);
+        if (id < 0) {
+            return id;
+        }
+        if (call == QMetaObject::InvokeMetaMethod && id == 0) {
+            sender->disconnect(conn);
+            callback(*reinterpret_cast<int*>(args[1]));
+        }
+        return id;
+    }
+};
+
+static QFuture<int> legacyObserve(BenchmarkEmitter* emitter, Qt::ConnectionType type)
+{
+    auto defer = Private::DeferredFuture<int>::create();
+    auto proxy = new LegacyProxy();
+
+    QObject::connect(emitter, &QObject::destroyed, proxy, [=]() {
+        defer->cancel();
+        delete proxy;
+    });
+
+    proxy->bind(emitter, QMetaMethod::fromSignal(&BenchmarkEmitter::valueChanged).methodIndex(), type);
+    proxy->callback = [=](int value) {
+        defer->complete(value);
+        delete proxy;
+    };
+
+    return defer->future();
+}
+
+// The member pointer path before and after it used single shot functor connections
+void Benchmarks::benchmark_observe_signal_by_member()
+{
+    // observe(object, &Class::signal) uses a single shot functor connection
+    BenchmarkEmitter emitter;
+
+    QBENCHMARK {
+        for (int i = 0 ; i < ObservationCount; i++) {
+            QFuture<int> future = observe(&emitter, &BenchmarkEmitter::valueChanged, ConnectionPolicy::Direct).future();
+            emitter.valueChanged(i);
+            QVERIFY(future.isFinished());
+        }
+    }
+}
+
+void Benchmarks::benchmark_observe_signal_by_proxy()
+{
+    // A proxy QObject and a DeferredFuture per observation
+    BenchmarkEmitter emitter;
+
+    QBENCHMARK {
+        for (int i = 0 ; i < ObservationCount; i++) {
+            QFuture<int> future = legacyObserve(&emitter, Qt::DirectConnection);
+            emitter.valueChanged(i);
+            QVERIFY(future.isFinished());
+        }
+    }
+
+    // Release the deferred objects of the last run
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
+
+// Depth of the binary tree of tasks in the fan-out benchmarks
+static const int FanOutDepth = 13;
+
+// Every task starts two sub-tasks on the same executor, like the mapped cookbook pattern
+template <typename Executor>
+static void fanOut(Executor* executor, QAtomicInt* leaves, int depth)
+{
+    if (depth == 0) {
+        leaves->fetchAndAddRelaxed(1);
+        return;
+    }
+
+    for (int i = 0 ; i < 2; i++) {
+        executor->start([=]() {
+            fanOut(executor, leaves, depth - 1);
+        });
+    }
+}
+
+void Benchmarks::benchmark_fan_out_qthreadpool()
+{
+    QThreadPool* pool = QThreadPool::globalInstance();
+
+    QBENCHMARK {
+        QAtomicInt leaves;
+        fanOut(pool, &leaves, FanOutDepth);
+        pool->waitForDone();
+        QCOMPARE(leaves.loadRelaxed(), 1 << FanOutDepth);
+    }
+}
+
+void Benchmarks::benchmark_fan_out_work_stealing()
+{
+    WorkStealingExecutor executor(QThreadPool::globalInstance()->maxThreadCount());
+
+    QBENCHMARK {
+        QAtomicInt leaves;
+        fanOut(&executor, &leaves, FanOutDepth);
+        executor.waitForDone();
+        QCOMPARE(leaves.loadRelaxed(), 1 << FanOutDepth);
+    }
+}
+
+// Timeouts per iteration
+static const int TimeoutCount = 1000;
+
+// Every timeout() creates two QFutureWatchers on the main thread. One of
+// them forwards the result through the event loop.
+void Benchmarks::benchmark_timeout_settled()
+{
+    QBENCHMARK {
+        std::vector<QPromise<int>> promises(TimeoutCount);
+        QList<QFuture<int>> futures;
+        for (QPromise<int>& promise : promises) {
+            promise.start();
+            futures << observe(promise.future()).timeout(60000).future();
+        }
+
+        for (QPromise<int>& promise : promises) {
+            promise.addResult(1);
+            promise.finish();
+        }
+
+        QTRY_VERIFY(futures.last().isFinished());
+        QCOMPARE(futures.last().result(), 1);
+    }
+
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
+
+// An expired timeout cancels the returned future on the timer thread,
+// so the wait below needs no event loop.
+void Benchmarks::benchmark_timeout_expired()
+{
+    QBENCHMARK {
+        std::vector<QPromise<int>> promises(TimeoutCount);
+        QList<QFuture<int>> futures;
+        for (QPromise<int>& promise : promises) {
+            promise.start();
+            futures << observe(promise.future()).timeout(0).future();
+        }
+
+        for (QFuture<int>& future : futures) {
+            future.waitForFinished();
+            QVERIFY(future.isCanceled());
+        }
+
+        for (QPromise<int>& promise : promises) {
+            promise.finish();
+        }
+    }
+
+    // Deliver the finished signals of the watchers and release them
+    QCoreApplication::processEvents();
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
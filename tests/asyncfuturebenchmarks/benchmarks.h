@@ -0,0 +1,29 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QObject>
+
+/// Emits the signal observed by the benchmarks
+class BenchmarkEmitter : public QObject
+{
+    Q_OBJECT
+signals:
+    void valueChanged(int value);
+};
+
+class Benchmarks : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Benchmarks(QObject *parent = nullptr);
+
+private slots:
+    void benchmark_observe_signal_by_member();
+    void benchmark_observe_signal_by_proxy();
+    void benchmark_fan_out_qthreadpool();
+    void benchmark_fan_out_work_stealing();
+    void benchmark_timeout_settled();
+    void benchmark_timeout_expired();
+};
+
+#endif // BENCHMARKS_H
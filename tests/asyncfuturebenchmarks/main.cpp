@@ -0,0 +1,11 @@
+#include <QCoreApplication>
+#include <QTest>
+#include "benchmarks.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Benchmarks benchmarks;
+    return QTest::qExec(&benchmarks, argc, argv);
+}
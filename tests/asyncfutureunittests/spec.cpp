@@ -1,3 +1,4 @@
+#include <numeric>
 #include <QtConcurrent>
 #include <QTest>
 #include <QFuture>
@@ -281,6 +282,93 @@ void Spec::test_private_DeferredFuture()
 
 }
 
+void Spec::test_private_TimerService()
+{
+    auto service = Private::TimerService::instance();
+    const int base = service->count();
+
+    {
+        // Arm and disarm many timers
+        QList<Private::TimerService::TimerId> ids;
+        for (int i = 0 ; i < 1000 ; i++) {
+            ids << service->arm(QDeadlineTimer(60000 + i * 100), []() {});
+        }
+        QCOMPARE(service->count(), base + 1000);
+
+        for (auto id : ids) {
+            QVERIFY(service->disarm(id));
+        }
+        QCOMPARE(service->count(), base);
+
+        // The nodes are reused with a new id
+        auto id = service->arm(QDeadlineTimer(60000), []() {});
+        QVERIFY(!ids.contains(id));
+        QVERIFY(!service->disarm(ids.first()));
+        QVERIFY(service->disarm(id));
+    }
+
+    {
+        // Fired in the order of their deadlines, and never before
+        QMutex mutex;
+        QList<int> order;
+        bool early = false;
+
+        const QList<int> msecs = {150, 10, 70, 30};
+        QList<Private::TimerService::TimerId> ids;
+        for (int msec : msecs) {
+            QDeadlineTimer deadline(msec, Qt::PreciseTimer);
+            ids << service->arm(deadline, [&, msec, deadline]() {
+                QMutexLocker locker(&mutex);
+                early = early || !deadline.hasExpired();
+                order << msec;
+            });
+        }
+
+        QVERIFY(waitUntil([&]() {
+            QMutexLocker locker(&mutex);
+            return order.size() == msecs.size();
+        }, 2000));
+
+        QCOMPARE(order, QList<int>({10, 30, 70, 150}));
+        QCOMPARE(early, false);
+
+        // A fired timer can't be disarmed
+        QVERIFY(!service->disarm(ids.first()));
+        QCOMPARE(service->count(), base);
+    }
+
+    {
+        // A timer of an upper level still fires after wakes right before a block boundary
+        const qint64 tickNSecs = 1000 * 1000;
+        const qint64 now = QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs() / tickNSecs;
+        const qint64 boundary = (now / 64 + 2) * 64;
+
+        QAtomicInt fired;
+        QAtomicInteger<qint64> late;
+        QDeadlineTimer deadline(boundary - now + 100, Qt::PreciseTimer);
+        service->arm(deadline, [&, deadline]() {
+            late.storeRelaxed(QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs() - deadline.deadlineNSecs());
+            fired.storeRelease(1);
+        });
+
+        // A wake on every tick up to the deadline, including the last tick of each block
+        for (qint64 tick = now + 1 ; tick < boundary + 100 ; tick++) {
+            QDeadlineTimer wake;
+            wake.setPreciseDeadline(tick / 1000, (tick % 1000) * tickNSecs, Qt::PreciseTimer);
+            service->arm(wake, []() {});
+        }
+
+        QVERIFY(waitUntil([&]() {
+            return fired.loadAcquire() == 1;
+        }, 2000));
+        QVERIFY(late.loadRelaxed() >= 0);
+        QVERIFY(late.loadRelaxed() < 500 * tickNSecs);
+        QVERIFY(waitUntil([&]() {
+            return service->count() == base;
+        }, 1000));
+    }
+}
+
 
 void Spec::test_private_run()
 {
@@ -598,6 +686,193 @@ void Spec::test_Observable_context_return_future()
 
 }
 
+void Spec::test_Observable_priority()
+{
+    QStringList order;
+
+    auto low = observe(completed<int>(1)).priority(Priority::Low);
+    QCOMPARE(low.priority(), Priority::Low);
+
+    auto lowChain = low.subscribe([&](int) {
+        order << "low";
+    });
+
+    auto highChain = observe(completed<int>(2)).priority(Priority::High).subscribe([&](int) {
+        order << "high";
+    });
+
+    // The priority is carried to the next stages
+    QCOMPARE(highChain.priority(), Priority::High);
+
+    auto normalChain = observe(completed<int>(3)).subscribe([&](int) {
+        order << "normal";
+    });
+
+    QVERIFY(waitUntil([&]() { return order.size() == 3; }, 1000));
+    QVERIFY(order.indexOf("high") < order.indexOf("low"));
+    QVERIFY(order.indexOf("normal") < order.indexOf("low"));
+    QCOMPARE(lowChain.future().isFinished(), true);
+    QCOMPARE(normalChain.future().isFinished(), true);
+}
+
+void Spec::test_Observable_run()
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(1);
+
+    // Keep the only thread busy until both stages are queued
+    QSemaphore gate;
+    pool.start([&]() {
+        gate.acquire();
+    });
+
+    QMutex mutex;
+    QStringList order;
+
+    auto record = [&](const QString& name) {
+        QMutexLocker locker(&mutex);
+        order << name;
+    };
+
+    auto low = observe(completed<int>(1)).priority(Priority::Low).run(&pool, [&](int value) {
+        record(QStringLiteral("low"));
+        return value * 10;
+    });
+
+    auto high = observe(completed<int>(2)).priority(Priority::High).run(&pool, [&](int value) {
+        record(QStringLiteral("high"));
+        return value * 10;
+    });
+
+    // The source futures are finished, so the stages are started within a few event loop turns
+    Test::tick();
+    Test::tick();
+
+    gate.release();
+    QVERIFY(waitUntil(low.future(), 2000));
+    QVERIFY(waitUntil(high.future(), 2000));
+
+    QCOMPARE(low.future().result(), 10);
+    QCOMPARE(high.future().result(), 20);
+    QCOMPARE(order, QStringList({"high", "low"}));
+
+    // Exceptions and void callbacks
+    auto failing = observe(completed<int>(1)).run(&pool, [](int) -> int {
+        throw QException();
+    });
+    QVERIFY(waitUntil(failing.future(), 2000));
+    QCOMPARE(failing.future().isCanceled(), true);
+
+    bool called = false;
+    auto voidStage = observe(completed<int>(1)).run(&pool, [&]() {
+        called = true;
+    });
+    QVERIFY(waitUntil(voidStage.future(), 2000));
+    QCOMPARE(called, true);
+}
+
+void Spec::test_Observable_timeout()
+{
+    {
+        // Not finished in time: canceled, and the cancellation is pushed upward
+        auto d = deferred<int>();
+        auto observable = observe(d.future()).timeout(50);
+
+        QVERIFY(waitUntil(observable.future(), 1000));
+        QCOMPARE(observable.future().isCanceled(), true);
+        QVERIFY(waitUntil([&]() {
+            return d.future().isCanceled();
+        }, 1000));
+    }
+
+    {
+        // Finished in time: the timer is disarmed
+        const int base = Private::TimerService::instance()->count();
+
+        auto d = deferred<int>();
+        auto observable = observe(d.future()).priority(Priority::High).timeout(200);
+        QCOMPARE(observable.priority(), Priority::High);
+        QCOMPARE(Private::TimerService::instance()->count(), base + 1);
+
+        d.complete(7);
+
+        QVERIFY(waitUntil(observable.future(), 1000));
+        QCOMPARE(observable.future().isCanceled(), false);
+        QCOMPARE(observable.future().result(), 7);
+        QCOMPARE(Private::TimerService::instance()->count(), base);
+
+        Automator::wait(300);
+        QCOMPARE(observable.future().isCanceled(), false);
+    }
+
+    {
+        // Expired: canceled by the timer thread, without the event loop
+        auto d = deferred<int>();
+        QFuture<int> future = observe(d.future()).timeout(20).future();
+
+        future.waitForFinished();
+        QCOMPARE(future.isCanceled(), true);
+    }
+
+    {
+        // Canceled before the deadline: the cancellation reaches the source at once
+        const int base = Private::TimerService::instance()->count();
+
+        auto d = deferred<int>();
+        QFuture<int> future = observe(d.future()).timeout(60000).future();
+        QCOMPARE(Private::TimerService::instance()->count(), base + 1);
+
+        future.cancel();
+        QVERIFY(waitUntil([&]() {
+            return d.future().isCanceled();
+        }, 1000));
+        QVERIFY(waitUntil(future, 1000));
+        QCOMPARE(Private::TimerService::instance()->count(), base);
+    }
+}
+
+void Spec::test_WorkStealingExecutor()
+{
+    WorkStealingExecutor executor(4);
+    QCOMPARE(executor.threadCount(), 4);
+
+    // Tasks started from the workers are run and counted by waitForDone()
+    QAtomicInt leaves;
+    std::function<void(int)> spawn = [&](int depth) {
+        if (depth == 0) {
+            leaves.fetchAndAddOrdered(1);
+            return;
+        }
+        executor.start([&spawn, depth]() { spawn(depth - 1); });
+        executor.start([&spawn, depth]() { spawn(depth - 1); });
+    };
+
+    spawn(10);
+    QCOMPARE(executor.waitForDone(5000), true);
+    QCOMPARE(leaves.loadRelaxed(), 1 << 10);
+
+    QFuture<int> future = executor.run([]() {
+        return 42;
+    });
+    QVERIFY(waitUntil(future, 2000));
+    QCOMPARE(future.result(), 42);
+
+    // Usable as the executor of a chain
+    auto stage = observe(future).run(&executor, [](int value) {
+        return value + 1;
+    });
+    QVERIFY(waitUntil(stage.future(), 2000));
+    QCOMPARE(stage.future().result(), 43);
+
+    QSemaphore gate;
+    executor.start([&]() {
+        gate.acquire();
+    });
+    QCOMPARE(executor.waitForDone(20), false);
+    gate.release();
+    QCOMPARE(executor.waitForDone(2000), true);
+}
+
 void Spec::test_Observable_signal()
 {
     auto proxy = new SignalProxy(this);
@@ -622,6 +897,69 @@ void Spec::test_Observable_signal()
     delete proxy;
 }
 
+void Spec::test_Observable_signal_lazy()
+{
+    auto proxy = new SignalProxy(this);
+
+    // The next emission is connected by the first future()
+    auto observable = observe(proxy, &SignalProxy::proxy1, ConnectionPolicy::Direct);
+    QCOMPARE(proxy->proxy1Receivers(), 0);
+
+    // A stream takes its own connection only
+    QFuture<int> stream = observable.stream();
+    QCOMPARE(proxy->proxy1Receivers(), 1);
+    stream.cancel();
+    QVERIFY(waitUntil(stream, 1000));
+    QCOMPARE(proxy->proxy1Receivers(), 0);
+
+    proxy->proxy1(6);
+    QFuture<int> future = observable.future();
+    QCOMPARE(proxy->proxy1Receivers(), 1);
+    QCOMPARE(future.isFinished(), false);
+
+    proxy->proxy1(7);
+    QVERIFY(waitUntil(future, 1000));
+    QCOMPARE(future.result(), 7);
+    QCOMPARE(proxy->proxy1Receivers(), 0);
+
+    delete proxy;
+}
+
+void Spec::test_Observable_signal_in_thread()
+{
+    auto proxy = new SignalProxy(this);
+
+    QThread thread;
+    thread.start();
+    QObject worker;
+    worker.moveToThread(&thread);
+
+    QSemaphore observed;
+    QSemaphore resume;
+    QFuture<int> future;
+
+    QMetaObject::invokeMethod(&worker, [&]() {
+        future = observe(proxy, &SignalProxy::proxy1).future();
+        observed.release();
+        resume.acquire();
+    });
+
+    observed.acquire();
+    proxy->proxy1(3);
+    Automator::wait(50);
+
+    // A queued emission is delivered to the observing thread, which is still busy
+    QCOMPARE(future.isFinished(), false);
+
+    resume.release();
+    QVERIFY(waitUntil(future, 1000));
+    QCOMPARE(future.result(), 3);
+
+    thread.quit();
+    thread.wait();
+    delete proxy;
+}
+
 void Spec::test_Observable_signal_with_argument()
 {
     auto *proxy = new SignalProxy(this);
@@ -649,6 +987,54 @@ void Spec::test_Observable_signal_with_argument()
     delete proxy;
 }
 
+void Spec::test_Observable_signal_with_arguments()
+{
+    auto *proxy = new SignalProxy(this);
+
+    QFuture<std::tuple<int, QString>> future = observe(proxy, &SignalProxy::proxy2).future();
+    QFuture<std::tuple<int, QString>> stream = observe(proxy, &SignalProxy::proxy2).stream();
+
+    proxy->proxy2(5, QStringLiteral("five"));
+    proxy->proxy2(6, QStringLiteral("six"));
+
+    QCOMPARE(future.isFinished(), false);
+
+    QVERIFY(waitUntil([&](){
+        return future.isFinished() && stream.resultCount() == 2;
+    }, 1000));
+
+    QCOMPARE(future.result(), std::make_tuple(5, QString("five")));
+    QCOMPARE(stream.resultAt(1), std::make_tuple(6, QString("six")));
+
+    delete proxy;
+}
+
+void Spec::test_Observable_signal_connection_policy()
+{
+    auto *proxy = new SignalProxy(this);
+
+    QFuture<int> queued = observe(proxy, &SignalProxy::proxy1).future();
+    QFuture<int> direct = observe(proxy, &SignalProxy::proxy1, ConnectionPolicy::Direct).future();
+    QFuture<int> autoFuture = observe(proxy, &SignalProxy::proxy1, ConnectionPolicy::Auto).future();
+    QFuture<QVariant> bySignature = observe(proxy, SIGNAL(proxy1(int)), ConnectionPolicy::Auto).future();
+
+    proxy->proxy1(7);
+
+    // Same thread: completed within the emitting call stack
+    QCOMPARE(direct.isFinished(), true);
+    QCOMPARE(direct.result(), 7);
+    QCOMPARE(autoFuture.isFinished(), true);
+    QCOMPARE(autoFuture.result(), 7);
+    QCOMPARE(bySignature.isFinished(), true);
+    QCOMPARE(bySignature.result().toInt(), 7);
+
+    QCOMPARE(queued.isFinished(), false);
+    await(queued);
+    QCOMPARE(queued.result(), 7);
+
+    delete proxy;
+}
+
 void Spec::test_Observable_signal_by_signature()
 {
 
@@ -717,6 +1103,23 @@ void Spec::test_Observable_signal_by_signature()
 
 }
 
+void Spec::test_Observable_signal_metadata_cache()
+{
+    auto cache = Private::SignalMetadataCache::instance();
+    SignalProxy proxy;
+
+    auto bySignature = cache->lookup(proxy.metaObject(), SIGNAL(proxy1(int)));
+    auto byName = cache->lookup(proxy.metaObject(), "proxy1(int)");
+    auto byMethod = cache->lookup(QMetaMethod::fromSignal(&SignalProxy::proxy1));
+
+    QVERIFY(bySignature.index >= 0);
+    QCOMPARE(byName.index, bySignature.index);
+    QCOMPARE(byMethod.index, bySignature.index);
+    QCOMPARE(bySignature.parameterTypes, QVector<int>({QMetaType::Int}));
+
+    QCOMPARE(cache->lookup(proxy.metaObject(), "noSuchSignal()").index, -1);
+}
+
 void Spec::test_Observable_signal_destroyed()
 {
     auto proxy = new SignalProxy(this);
@@ -733,87 +1136,261 @@ void Spec::test_Observable_signal_destroyed()
     QCOMPARE(vFuture.isCanceled(), true);
 }
 
-void Spec::test_Observable_subscribe()
+void Spec::test_Observable_signal_stream()
 {
     {
-        // complete
-        auto o = deferred<int>();
-        auto c1 = Callable<int>();
-        auto result = o.subscribe(c1.func).future();
+        // One result per emission, finished when the object is destroyed
+        auto proxy = new SignalProxy(this);
+        QFuture<int> future = observe(proxy, &SignalProxy::proxy1).stream();
 
-        QCOMPARE(result.isFinished(), false);
-        o.complete(10);
+        proxy->proxy1(1);
+        proxy->proxy1(2);
+        proxy->proxy1(3);
 
-        QCOMPARE(c1.called, false);
-        waitUntil(o.future());
-        QCOMPARE(c1.called, true);
-        QCOMPARE(c1.value, 10);
-        QCOMPARE(result.isFinished(), true);
-        QCOMPARE(result.isCanceled(), false);
+        QCOMPARE(future.resultCount(), 0);
+
+        QVERIFY(waitUntil([&](){
+            return future.resultCount() == 3;
+        }, 1000));
+
+        QCOMPARE(future.results(), QList<int>({1, 2, 3}));
+        QCOMPARE(future.isFinished(), false);
+
+        delete proxy;
+        await(future);
+
+        QCOMPARE(future.isFinished(), true);
+        QCOMPARE(future.isCanceled(), false);
     }
 
     {
-        // complete
-        auto f = completed<int>(5);
-        auto c1 = Callable<int>();
-        auto result = observe(f).subscribe(c1.func).future();
+        // A void signal streams the index of the emission
+        auto proxy = new SignalProxy(this);
+        QFuture<int> future = observe(proxy, &SignalProxy::proxy0).stream();
 
-        QCOMPARE(result.isFinished(), false);
-        QCOMPARE(c1.called, false);
+        proxy->proxy0();
+        proxy->proxy0();
+        delete proxy;
+        await(future);
 
-        waitUntil(f);
-        QCOMPARE(c1.called, true);
-        QCOMPARE(c1.value, 5);
-        QCOMPARE(result.isFinished(), true);
-        QCOMPARE(result.isCanceled(), false);
+        QCOMPARE(future.results(), QList<int>({0, 1}));
     }
 
     {
-        // cancel
-        auto o = deferred<int>();
-        auto c1 = Callable<int>();
-        auto c2 = Callable<void>();
-        auto result = o.subscribe(c1.func, c2.func).future();
-        o.cancel();
+        // Bounded buffer
+        auto proxy = new SignalProxy(this);
+        QFuture<int> dropOldest = observe(proxy, &SignalProxy::proxy1).stream(2, OverflowPolicy::DropOldest);
+        QFuture<int> coalesce = observe(proxy, &SignalProxy::proxy1).stream(2, OverflowPolicy::Coalesce);
 
-        QCOMPARE(c1.called, false);
-        QCOMPARE(result.isFinished(), false);
+        for (int i = 1 ; i <= 5; i++) {
+            proxy->proxy1(i);
+        }
+        delete proxy;
+        await(dropOldest);
+        await(coalesce);
 
-        waitUntil(o.future());
+        QCOMPARE(dropOldest.results(), QList<int>({4, 5}));
+        QCOMPARE(coalesce.results(), QList<int>({1, 5}));
+    }
 
-        QCOMPARE(c1.called, false);
-        QCOMPARE(c2.called, true);
-        QCOMPARE(result.isFinished(), true);
-        QCOMPARE(result.isCanceled(), true);
+    {
+        // Cancel to stop, without waiting for the next emission
+        auto proxy = new SignalProxy(this);
+        QFuture<int> future = observe(proxy, &SignalProxy::proxy1).stream();
+
+        future.cancel();
+        QVERIFY(waitUntil(future, 1000));
+        QCOMPARE(future.isCanceled(), true);
+
+        proxy->proxy1(1);
+        QCOMPARE(future.resultCount(), 0);
+        delete proxy;
     }
 }
 
-void Spec::test_Observable_subscribe_in_thread()
+void Spec::test_Observable_signal_when()
 {
-    QThreadPool pool;
-    pool.setMaxThreadCount(4);
+    {
+        auto proxy = new SignalProxy(this);
+        QFuture<int> future = observe(proxy, &SignalProxy::proxy1).when([](int value) {
+            return value >= 2;
+        }).future();
 
-    auto worker = [&]() -> void {
-        QThread* workerThread = QThread::currentThread();
+        proxy->proxy1(1);
+        QCOMPARE(future.isFinished(), false);
 
-        QVERIFY(workerThread != QCoreApplication::instance()->thread());
+        // Completed in the emitting call stack
+        proxy->proxy1(2);
+        QCOMPARE(future.isFinished(), true);
+        QCOMPARE(future.result(), 2);
 
-        auto worker = [=]() -> void {
-            QVERIFY(QThread::currentThread() != workerThread);
-            Automator::wait(50);
-        };
+        proxy->proxy1(3);
+        QCOMPARE(future.result(), 2);
+        QCOMPARE(future.resultCount(), 1);
 
-        auto cleanup = [&]() -> void {
-            QVERIFY(QThread::currentThread() == QCoreApplication::instance()->thread());
-            Automator::wait(50);
-        };
+        delete proxy;
+    }
 
-        auto f1 = QtConcurrent::run(&pool, worker);
-        auto f2 = observe(f1).subscribe(cleanup).future();
+    {
+        // Canceled if the object is destroyed before a match
+        auto proxy = new SignalProxy(this);
+        QFuture<int> future = observe(proxy, &SignalProxy::proxy1).when([](int value) {
+            return value < 0;
+        }).future();
 
-        QVERIFY(waitUntil([&](){
-            return f2.isFinished();
-        }, 1000));
+        proxy->proxy1(1);
+        delete proxy;
+
+        QCOMPARE(future.isFinished(), true);
+        QCOMPARE(future.isCanceled(), true);
+    }
+
+    {
+        // One connection per when(), released on the match
+        auto proxy = new SignalProxy(this);
+        auto signal = observe(proxy, &SignalProxy::proxy1);
+
+        QFuture<int> positive = signal.when([](int value) {
+            return value > 0;
+        }).future();
+        QFuture<int> negative = signal.when([](int value) {
+            return value < 0;
+        }).future();
+        QCOMPARE(proxy->proxy1Receivers(), 2);
+
+        proxy->proxy1(1);
+        QCOMPARE(positive.result(), 1);
+        QCOMPARE(negative.isFinished(), false);
+        QCOMPARE(proxy->proxy1Receivers(), 1);
+
+        proxy->proxy1(-1);
+        QCOMPARE(negative.result(), -1);
+        QCOMPARE(proxy->proxy1Receivers(), 0);
+
+        delete proxy;
+    }
+}
+
+void Spec::test_Observable_signal_operators()
+{
+    auto proxy = new SignalProxy(this);
+    auto signal = observe(proxy, &SignalProxy::proxy1);
+
+    QFuture<int> debounced = signal.debounce(50).stream();
+    QFuture<int> throttled = signal.throttle(60000).stream();
+    QFuture<int> sampled = signal.sample(50).stream();
+    QFuture<int> distinct = signal.distinctUntilChanged().stream();
+    QFuture<int> next = signal.debounce(50).future();
+
+    for (int value : {1, 1, 2, 2, 3}) {
+        proxy->proxy1(value);
+    }
+
+    QVERIFY(waitUntil([&](){
+        return debounced.resultCount() == 1 && sampled.resultCount() == 1 && next.isFinished();
+    }, 1000));
+
+    QCOMPARE(debounced.results(), QList<int>({3}));
+    QCOMPARE(sampled.results(), QList<int>({3}));
+    QCOMPARE(next.result(), 3);
+
+    proxy->proxy1(4);
+    QVERIFY(waitUntil([&](){
+        return debounced.resultCount() == 2 && sampled.resultCount() == 2;
+    }, 1000));
+
+    delete proxy;
+    await(debounced);
+    await(throttled);
+    await(distinct);
+
+    QCOMPARE(debounced.results(), QList<int>({3, 4}));
+    QCOMPARE(sampled.results(), QList<int>({3, 4}));
+    QCOMPARE(throttled.results(), QList<int>({1}));
+    QCOMPARE(distinct.results(), QList<int>({1, 2, 3, 4}));
+}
+
+void Spec::test_Observable_subscribe()
+{
+    {
+        // complete
+        auto o = deferred<int>();
+        auto c1 = Callable<int>();
+        auto result = o.subscribe(c1.func).future();
+
+        QCOMPARE(result.isFinished(), false);
+        o.complete(10);
+
+        QCOMPARE(c1.called, false);
+        waitUntil(o.future());
+        QCOMPARE(c1.called, true);
+        QCOMPARE(c1.value, 10);
+        QCOMPARE(result.isFinished(), true);
+        QCOMPARE(result.isCanceled(), false);
+    }
+
+    {
+        // complete
+        auto f = completed<int>(5);
+        auto c1 = Callable<int>();
+        auto result = observe(f).subscribe(c1.func).future();
+
+        QCOMPARE(result.isFinished(), false);
+        QCOMPARE(c1.called, false);
+
+        waitUntil(f);
+        QCOMPARE(c1.called, true);
+        QCOMPARE(c1.value, 5);
+        QCOMPARE(result.isFinished(), true);
+        QCOMPARE(result.isCanceled(), false);
+    }
+
+    {
+        // cancel
+        auto o = deferred<int>();
+        auto c1 = Callable<int>();
+        auto c2 = Callable<void>();
+        auto result = o.subscribe(c1.func, c2.func).future();
+        o.cancel();
+
+        QCOMPARE(c1.called, false);
+        QCOMPARE(result.isFinished(), false);
+
+        waitUntil(o.future());
+
+        QCOMPARE(c1.called, false);
+        QCOMPARE(c2.called, true);
+        QCOMPARE(result.isFinished(), true);
+        QCOMPARE(result.isCanceled(), true);
+    }
+}
+
+void Spec::test_Observable_subscribe_in_thread()
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+
+    auto worker = [&]() -> void {
+        QThread* workerThread = QThread::currentThread();
+
+        QVERIFY(workerThread != QCoreApplication::instance()->thread());
+
+        auto worker = [=]() -> void {
+            QVERIFY(QThread::currentThread() != workerThread);
+            Automator::wait(50);
+        };
+
+        auto cleanup = [&]() -> void {
+            QVERIFY(QThread::currentThread() == QCoreApplication::instance()->thread());
+            Automator::wait(50);
+        };
+
+        auto f1 = QtConcurrent::run(&pool, worker);
+        auto f2 = observe(f1).subscribe(cleanup).future();
+
+        QVERIFY(waitUntil([&](){
+            return f2.isFinished();
+        }, 1000));
     };
 
     QFuture<void> future = QtConcurrent::run(&pool, worker);
@@ -1401,6 +1978,66 @@ void Spec::test_Deferred_complete_empty_list()
     QVERIFY(future.results() == expected);
 }
 
+void Spec::test_Deferred_complete_large_list()
+{
+    QList<int> expected(100000);
+    std::iota(expected.begin(), expected.end(), 0);
+
+    {
+        auto defer = deferred<int>();
+        QList<int> input = expected;
+        defer.complete(std::move(input));
+
+        auto future = defer.future();
+        QVERIFY(future.isFinished());
+        QCOMPARE(future.resultCount(), int(expected.size()));
+        QVERIFY(future.results() == expected);
+    }
+
+    {
+        QList<int> input = expected;
+        auto future = completed(std::move(input));
+
+        QVERIFY(future.isFinished());
+        QVERIFY(future.results() == expected);
+    }
+}
+
+void Spec::test_Deferred_reportResult()
+{
+    auto defer = deferred<int>();
+    QList<int> indexes;
+    QList<int> values;
+
+    defer.onResultReadyAt(this, [&](int index, int value) {
+        indexes << index;
+        values << value;
+    });
+
+    defer.reportResult(1);
+    defer.reportResults(QList<int>({2, 3}));
+
+    // Consumed before the production is finished
+    QVERIFY(waitUntil([&](){
+        return values.size() == 3;
+    }, 1000));
+
+    QCOMPARE(indexes, QList<int>({0, 1, 2}));
+    QCOMPARE(values, QList<int>({1, 2, 3}));
+    QCOMPARE(defer.future().isFinished(), false);
+
+    defer.reportResult(4);
+    defer.finish();
+
+    QCOMPARE(defer.future().isFinished(), true);
+    QCOMPARE(defer.future().isCanceled(), false);
+    QCOMPARE(defer.future().results(), QList<int>({1, 2, 3, 4}));
+
+    QVERIFY(waitUntil([&](){
+        return values.size() == 4;
+    }, 1000));
+}
+
 void Spec::test_Deferred_cancel_future()
 {
 
@@ -1494,6 +2131,48 @@ void Spec::test_Deferred_future_cancel()
 
 }
 
+void Spec::test_Deferred_cancelAfter()
+{
+    const int base = Private::TimerService::instance()->count();
+
+    {
+        auto defer = deferred<int>();
+        defer.cancelAfter(50);
+
+        QVERIFY(waitUntil(defer.future(), 1000));
+        QCOMPARE(defer.future().isCanceled(), true);
+    }
+
+    {
+        // Completed in time: the timer is disarmed
+        auto defer = deferred<void>();
+        defer.cancelAfter(100);
+        QCOMPARE(Private::TimerService::instance()->count(), base + 1);
+
+        defer.complete();
+        QCOMPARE(Private::TimerService::instance()->count(), base);
+
+        Automator::wait(200);
+        QCOMPARE(defer.future().isCanceled(), false);
+    }
+
+    {
+        // A later call replaces the previous deadline
+        auto defer = deferred<int>();
+        defer.cancelAfter(50);
+        defer.cancelAfter(5000);
+        QCOMPARE(Private::TimerService::instance()->count(), base + 1);
+
+        Automator::wait(150);
+        QCOMPARE(defer.future().isFinished(), false);
+
+        defer.complete(1);
+        QCOMPARE(defer.future().result(), 1);
+    }
+
+    QCOMPARE(Private::TimerService::instance()->count(), base);
+}
+
 void Spec::test_Deferred_across_thread()
 {
     auto defer = deferred<int>();
@@ -1516,8 +2195,21 @@ void Spec::test_Deferred_inherit()
         CustomDeferredVoid() {
             deferredFuture->setProgressRange(0, 3);
         }
+
+        // The member used to be a QSharedPointer<Private::DeferredFuture<void>>
+        QSharedPointer<Private::DeferredFuture<void>> shared() const {
+            QSharedPointer<Private::DeferredFuture<void>> ptr = deferredFuture;
+            return ptr;
+        }
     };
 
+    {
+        CustomDeferredVoid defer;
+        auto ptr = defer.shared();
+        QVERIFY(!ptr.isNull());
+        QCOMPARE(ptr->future().progressMaximum(), 3);
+    }
+
     class CustomDeferredInt : public Deferred<int> {
     public:
         CustomDeferredInt() {
@@ -1569,6 +2261,149 @@ void Spec::test_Deferred_inherit()
     }
 }
 
+void Spec::test_Deferred_lazy()
+{
+    class CustomDeferred : public Deferred<int> {
+    public:
+        bool isMaterialized() const {
+            return deferredFuture.isMaterialized();
+        }
+    };
+
+    {
+        // Completed without a DeferredFuture
+        CustomDeferred defer;
+        auto future = defer.subscribe([](int value) {
+            return value + 1;
+        }).future();
+
+        defer.complete(1);
+        QCOMPARE(defer.isMaterialized(), false);
+        QCOMPARE(defer.future().result(), 1);
+
+        await(future);
+        QCOMPARE(future.result(), 2);
+    }
+
+    {
+        // Auto cancellation
+        QFuture<int> future;
+        {
+            CustomDeferred defer;
+            future = defer.future();
+        }
+        QCOMPARE(future.isCanceled(), true);
+    }
+
+    {
+        // Materialized to observe another future
+        auto source = deferred<int>();
+        QFuture<int> future;
+        {
+            CustomDeferred defer;
+            defer.complete(source.future());
+            QCOMPARE(defer.isMaterialized(), true);
+            future = defer.future();
+        }
+
+        source.complete(3);
+        await(future);
+        QCOMPARE(future.isCanceled(), false);
+        QCOMPARE(future.result(), 3);
+    }
+}
+
+void Spec::test_Promise()
+{
+    {
+        // Complete from a worker thread
+        Promise<int> promise;
+        QFuture<int> future = promise.future();
+
+        auto observed = observe(future).subscribe([](int value) {
+            return value * 2;
+        }).future();
+
+        QFuture<void> worker = QtConcurrent::run([promise = std::move(promise)]() mutable {
+            promise.setProgressRange(0, 2);
+            promise.reportResult(1);
+            promise.setProgressValue(1);
+            promise.complete(2);
+        });
+
+        await(worker);
+        QCOMPARE(future.isFinished(), true);
+        QCOMPARE(future.results(), QList<int>({1, 2}));
+
+        await(observed);
+        QCOMPARE(observed.result(), 2);
+    }
+
+    {
+        // Auto cancellation and combine()
+        QFuture<void> combined;
+        QFuture<int> future;
+        {
+            Promise<int> promise;
+            Promise<void> done;
+            future = promise.future();
+
+            auto combinator = combine(AllSettled);
+            combinator << promise << done;
+            combined = combinator.future();
+            done.complete();
+        }
+
+        QCOMPARE(future.isCanceled(), true);
+        await(combined);
+        QCOMPARE(combined.isFinished(), true);
+    }
+
+    {
+        // Complete by another future
+        auto defer = deferred<int>();
+        Promise<int> promise;
+        promise.complete(defer.future());
+
+        defer.complete(5);
+        QVERIFY(waitUntil(promise.future(), 1000));
+        QCOMPARE(promise.future().result(), 5);
+
+        Promise<int> canceled;
+        QFuture<int> input = canceled.future();
+        Promise<int> follower;
+        follower.complete(input);
+        canceled.cancel();
+        QVERIFY(waitUntil(follower.future(), 1000));
+        QCOMPARE(follower.future().isCanceled(), true);
+    }
+
+    {
+        // The caller's then() on the input future is kept
+        auto defer = deferred<int>();
+        QFuture<int> input = defer.future();
+
+        auto chained = input.then(QtFuture::Launch::Sync, [](int value) {
+            return value + 1;
+        });
+
+        Promise<int> promise;
+        promise.complete(input);
+        promise.track(input);
+
+        defer.setProgressRange(0, 1);
+        defer.setProgressValue(1);
+        defer.complete(5);
+
+        QVERIFY(waitUntil(promise.future(), 1000));
+        QCOMPARE(promise.future().result(), 5);
+        QCOMPARE(promise.future().progressMaximum(), 1);
+
+        QVERIFY(waitUntil(chained, 1000));
+        QCOMPARE(chained.result(), 6);
+    }
+}
+
 void Spec::test_Deferred_track()
 {
     class CustomDeferred : public Deferred<int> {
@@ -1929,84 +2764,460 @@ void Spec::test_Combinator_progressValue()
         QCOMPARE(future.progressValue(), 3);
         QCOMPARE(future.progressMaximum(), 3);
 
-    }
+    }
+
+}
+
+void Spec::test_Combinator_onEach()
+{
+    auto d1 = deferred<int>();
+    auto d2 = deferred<int>();
+    auto d3 = deferred<int>();
+
+    QList<int> indexes;
+    QList<int> values;
+
+    auto combinator = combine(AllSettled);
+    combinator << d1 << d2 << d3;
+
+    combinator.onEach(this, [&](int index, QFuture<int> future) {
+        indexes << index;
+        if (!future.isCanceled()) {
+            values << future.result();
+        }
+    });
+
+    d2.complete(2);
+    QVERIFY(waitUntil([&]() {
+        return indexes.size() == 1;
+    }, 1000));
+
+    // The early result is delivered before the other children settle
+    QCOMPARE(indexes, QList<int>() << 1);
+    QCOMPARE(values, QList<int>() << 2);
+    QCOMPARE(combinator.future().isFinished(), false);
+
+    d3.cancel();
+    d1.complete(1);
+
+    QVERIFY(waitUntil(combinator.future(), 1000));
+    QCOMPARE(indexes.size(), 3);
+    QCOMPARE(values, QList<int>() << 2 << 1);
+
+    // A callback registered later replays the settled children
+    QList<int> replayed;
+    combinator.onEach(this, [&](int index) {
+        replayed << index;
+    });
+    std::sort(replayed.begin(), replayed.end());
+    QCOMPARE(replayed, QList<int>() << 0 << 1 << 2);
+}
+
+void Spec::test_Combinator_stream()
+{
+    {
+        // Unordered
+        auto d1 = deferred<int>();
+        auto d2 = deferred<int>();
+        auto d3 = deferred<int>();
+
+        auto combinator = combine();
+        combinator << d1 << d2 << d3;
+
+        QFuture<int> stream = combinator.stream<int>();
+
+        d3.complete(3);
+        QVERIFY(waitUntil([&]() {
+            return stream.resultCount() == 1;
+        }, 1000));
+        QCOMPARE(stream.resultAt(0), 3);
+        QCOMPARE(stream.isFinished(), false);
+
+        d1.complete(1);
+        d2.complete(2);
+
+        QVERIFY(waitUntil(stream, 1000));
+        QCOMPARE(stream.isCanceled(), false);
+        QCOMPARE(stream.results(), QList<int>() << 3 << 1 << 2);
+    }
+
+    {
+        // Ordered
+        auto d1 = deferred<int>();
+        auto d2 = deferred<int>();
+        auto d3 = deferred<int>();
+
+        auto combinator = combine();
+        combinator << d1 << d2 << d3;
+
+        QFuture<int> stream = combinator.stream<int>(StreamOrder::Ordered);
+
+        d3.complete(3);
+        tick();
+        QCOMPARE(stream.resultCount(), 0);
+
+        d1.complete(1);
+        QVERIFY(waitUntil([&]() {
+            return stream.resultCount() == 1;
+        }, 1000));
+        QCOMPARE(stream.resultAt(0), 1);
+
+        d2.complete(2);
+
+        QVERIFY(waitUntil(stream, 1000));
+        QCOMPARE(stream.isCanceled(), false);
+        QCOMPARE(stream.results(), QList<int>() << 1 << 2 << 3);
+    }
+}
+
+void Spec::test_Combinator_timeout()
+{
+    {
+        // withTimeout(): AllSettled waits for the other children
+        auto d1 = deferred<int>();
+        auto d2 = deferred<int>();
+        auto d3 = deferred<int>();
+
+        auto combinator = combine(AllSettled);
+        combinator.withTimeout(100) << d1 << d2 << d3;
+
+        d1.complete(1);
+
+        QVERIFY(waitUntil([&]() {
+            return d2.future().isCanceled() && d3.future().isCanceled();
+        }, 1000));
+
+        QVERIFY(waitUntil(combinator.future(), 1000));
+        QCOMPARE(combinator.future().isCanceled(), true);
+        QCOMPARE(d1.future().isCanceled(), false);
+        QCOMPARE(combinator.future().progressValue(), 3);
+    }
+
+    {
+        // Per-child deadline: FailFast
+        auto d1 = deferred<int>();
+        auto d2 = deferred<int>();
+
+        auto combinator = combine();
+        combinator.addFuture(d1.future(), QDeadlineTimer(50));
+        combinator << d2;
+
+        Callable<void> canceled;
+        observe(combinator.future()).subscribe([]() {}, canceled.func);
+
+        QVERIFY(waitUntil(combinator.future(), 1000));
+        QCOMPARE(combinator.future().isCanceled(), true);
+        QCOMPARE(d1.future().isCanceled(), true);
+        QVERIFY(waitUntil([&]() {
+            return canceled.called;
+        }, 1000));
+    }
+
+    {
+        // Children settled before the deadline are not affected
+        auto d1 = deferred<int>();
+        auto d2 = deferred<int>();
+
+        auto combinator = combine();
+        combinator.withTimeout(200) << d1 << d2;
+
+        d1.complete(1);
+        d2.complete(2);
+
+        QVERIFY(waitUntil(combinator.future(), 1000));
+        QCOMPARE(combinator.future().isCanceled(), false);
+
+        Automator::wait(300);
+        QCOMPARE(d1.future().isCanceled(), false);
+        QCOMPARE(d2.future().isCanceled(), false);
+    }
+}
+
+void Spec::test_alive()
+{
+
+    {
+        auto d1 = deferred<TrackingData>();
+        auto d2 = deferred<TrackingData>();
+
+        d2.complete(d1.future());
+
+        QCOMPARE(TrackingData::aliveCount(), 0);
+
+        {
+            TrackingData dummy;
+            d1.complete(dummy);
+            QCOMPARE(TrackingData::aliveCount(), 1);
+        }
+
+        QCOMPARE(TrackingData::aliveCount(), 1);
+
+        await(d2.future());
+        Automator::wait(10);
+    }
+
+    Automator::wait(10);
+    QCOMPARE(TrackingData::aliveCount(), 0);
+
+}
+
+void Spec::test_completed() {
+    {
+        auto f = AsyncFuture::completed();
+        QCOMPARE(f.isRunning(), false);
+        QCOMPARE(f.isFinished(), true);
+        QCOMPARE(f.isCanceled(), false);
+    }
+    {
+        auto f = AsyncFuture::completed<int>(5);
+        QCOMPARE(f.isRunning(), false);
+        QCOMPARE(f.isFinished(), true);
+        QCOMPARE(f.isCanceled(), false);
+        QCOMPARE(f.result(), 5);
+        QCOMPARE(f.progressValue(), 1);
+        QCOMPARE(f.progressMinimum(), 0);
+        QCOMPARE(f.progressMaximum(), 1);
+    }
+    {
+        QList<int> completeData = {1,2,3,4,5};
+        auto f = AsyncFuture::completed(completeData);
+        QCOMPARE(f.isRunning(), false);
+        QCOMPARE(f.isFinished(), true);
+        QCOMPARE(f.isCanceled(), false);
+        QCOMPARE(f.results(), completeData);
+        QCOMPARE(f.progressValue(), 5);
+        QCOMPARE(f.progressMinimum(), 0);
+        QCOMPARE(f.progressMaximum(), completeData.size());
+    }
+
+    {
+        QList<int> emptyList;
+        auto f = completed(emptyList);
+        QCOMPARE(f.isRunning(), false);
+        QCOMPARE(f.isFinished(), true);
+        QCOMPARE(f.isCanceled(), false);
+        QCOMPARE(f.resultCount(), 0);
+        QCOMPARE(f.results(), emptyList);
+        QCOMPARE(f.progressValue(), 0);
+        QCOMPARE(f.progressMinimum(), 0);
+        QCOMPARE(f.progressMaximum(), emptyList.size());
+
+    }
+}
+
+void Spec::test_delay() {
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        auto f = AsyncFuture::delay(50);
+        QCOMPARE(f.isFinished(), false);
+
+        QVERIFY(waitUntil(f, 1000));
+        QCOMPARE(f.isCanceled(), false);
+        QVERIFY(timer.elapsed() >= 50);
+    }
+
+    {
+        // Beyond the first level of the timer wheel, next to shorter delays
+        QElapsedTimer timer;
+        timer.start();
+
+        QList<QFuture<void>> shorter;
+        for (int i = 1 ; i < 200 ; i++) {
+            shorter << AsyncFuture::delay(i);
+        }
+        auto f = AsyncFuture::delay(200);
+
+        QVERIFY(waitUntil(f, 1000));
+        QVERIFY(timer.elapsed() >= 200);
+        QVERIFY(timer.elapsed() < 700);
+        QVERIFY(waitAll(shorter, 1000));
+    }
+
+    {
+        // From a worker thread without an event loop
+        auto worker = QtConcurrent::run([]() {
+            QFuture<void> f = AsyncFuture::delayUntil(QDeadlineTimer(30, Qt::PreciseTimer));
+            return AsyncFuture::waitForFinished(f, 1000, WaitMode::Blocking);
+        });
+
+        QVERIFY(waitUntil(worker, 2000));
+        QCOMPARE(worker.result(), true);
+    }
+
+    {
+        // Many pending timers
+        QList<QFuture<void>> futures;
+        for (int i = 0 ; i < 10000 ; i++) {
+            futures << AsyncFuture::delay(10 + i % 50);
+        }
+
+        QVERIFY(waitAll(futures, 2000));
+    }
+}
+
+void Spec::test_interval() {
+    {
+        auto f = AsyncFuture::interval(10, 5);
+        QVERIFY(waitUntil(f, 1000));
+        QCOMPARE(f.isCanceled(), false);
+        QCOMPARE(f.results(), QList<int>({0, 1, 2, 3, 4}));
+    }
+
+    {
+        // Consume the ticks while it is running, then cancel it
+        auto f = AsyncFuture::interval(10);
+        QList<int> ticks;
+
+        observe(f).onResultReadyAt([&](int, int index) {
+            ticks << index;
+        });
+
+        QVERIFY(waitUntil([&]() {
+            return ticks.size() >= 3;
+        }, 1000));
+        QCOMPARE(f.isFinished(), false);
+
+        f.cancel();
+        QVERIFY(waitUntil(f, 1000));
+        QCOMPARE(f.isCanceled(), true);
+        QCOMPARE(ticks.mid(0, 3), QList<int>({0, 1, 2}));
+    }
+}
+
+void Spec::test_mapConcurrent() {
+    QList<int> input;
+    for (int i = 0 ; i < 20 ; i++) {
+        input << i;
+    }
+
+    QAtomicInt running(0);
+    QAtomicInt maxRunning(0);
+
+    QFuture<int> future = mapConcurrent(input, [&](int value) {
+        return QtConcurrent::run([&running, &maxRunning, value]() {
+            int current = running.fetchAndAddOrdered(1) + 1;
+            int max = maxRunning.loadAcquire();
+            while (current > max && !maxRunning.testAndSetOrdered(max, current)) {
+                max = maxRunning.loadAcquire();
+            }
+            QThread::msleep(10);
+            running.fetchAndAddOrdered(-1);
+            return value * value;
+        });
+    }, 3);
+
+    QCOMPARE(future.progressMaximum(), 20);
+
+    QVERIFY(waitUntil(future, 5000));
+    QCOMPARE(future.isCanceled(), false);
+    QVERIFY(maxRunning.loadAcquire() <= 3);
+    QCOMPARE(future.progressValue(), 20);
+
+    QList<int> expected;
+    for (int i = 0 ; i < 20 ; i++) {
+        expected << i * i;
+    }
+    QCOMPARE(future.results(), expected);
+
+    {
+        // Empty input
+        QFuture<int> empty = mapConcurrent(QList<int>(), [](int value) {
+            return completed<int>(value);
+        });
+        QCOMPARE(empty.isFinished(), true);
+        QCOMPARE(empty.isCanceled(), false);
+    }
+}
+
+void Spec::test_mapConcurrent_cancel() {
+    QList<int> input;
+    for (int i = 0 ; i < 10 ; i++) {
+        input << i;
+    }
+
+    QList<Deferred<int>> launched;
+
+    QFuture<int> future = mapConcurrent(input, [&](int value) {
+        Q_UNUSED(value);
+        auto defer = deferred<int>();
+        launched << defer;
+        return defer.future();
+    }, 2);
+
+    QCOMPARE(launched.size(), 2);
 
-}
+    launched[0].complete(0);
+    QVERIFY(waitUntil([&]() {
+        return launched.size() == 3;
+    }, 1000));
 
-void Spec::test_alive()
-{
+    future.cancel();
 
-    {
-        auto d1 = deferred<TrackingData>();
-        auto d2 = deferred<TrackingData>();
+    QVERIFY(waitUntil([&]() {
+        return launched[1].future().isCanceled() && launched[2].future().isCanceled();
+    }, 1000));
 
-        d2.complete(d1.future());
+    tick();
+    // Pending inputs are never launched
+    QCOMPARE(launched.size(), 3);
+    QCOMPARE(future.isCanceled(), true);
+}
 
-        QCOMPARE(TrackingData::aliveCount(), 0);
+void Spec::test_waitForFinished() {
 
-        {
-            TrackingData dummy;
-            d1.complete(dummy);
-            QCOMPARE(TrackingData::aliveCount(), 1);
-        }
+}
 
-        QCOMPARE(TrackingData::aliveCount(), 1);
+void Spec::test_waitForFinished_blocking() {
+    QSemaphore gate;
+    auto future = QtConcurrent::run([&]() {
+        gate.acquire();
+        return 7;
+    });
 
-        await(d2.future());
-        Automator::wait(10);
-    }
+    QCOMPARE(waitForFinished(future, 20, WaitMode::Blocking), false);
 
-    Automator::wait(10);
-    QCOMPARE(TrackingData::aliveCount(), 0);
+    // It works on a thread without an event loop
+    QAtomicInt waited(0);
+    auto waiter = QtConcurrent::run([&, future]() {
+        waited.storeRelease(waitForFinished(future, 5000, WaitMode::Blocking) ? 1 : -1);
+    });
 
+    gate.release();
+    waiter.waitForFinished();
+    QCOMPARE(waited.loadAcquire(), 1);
+    QCOMPARE(waitForFinished(future, -1, WaitMode::Blocking), true);
+    QCOMPARE(future.result(), 7);
 }
 
-void Spec::test_completed() {
-    {
-        auto f = AsyncFuture::completed();
-        QCOMPARE(f.isRunning(), false);
-        QCOMPARE(f.isFinished(), true);
-        QCOMPARE(f.isCanceled(), false);
-    }
-    {
-        auto f = AsyncFuture::completed<int>(5);
-        QCOMPARE(f.isRunning(), false);
-        QCOMPARE(f.isFinished(), true);
-        QCOMPARE(f.isCanceled(), false);
-        QCOMPARE(f.result(), 5);
-        QCOMPARE(f.progressValue(), 1);
-        QCOMPARE(f.progressMinimum(), 0);
-        QCOMPARE(f.progressMaximum(), 1);
-    }
-    {
-        QList<int> completeData = {1,2,3,4,5};
-        auto f = AsyncFuture::completed(completeData);
-        QCOMPARE(f.isRunning(), false);
-        QCOMPARE(f.isFinished(), true);
-        QCOMPARE(f.isCanceled(), false);
-        QCOMPARE(f.results(), completeData);
-        QCOMPARE(f.progressValue(), 5);
-        QCOMPARE(f.progressMinimum(), 0);
-        QCOMPARE(f.progressMaximum(), completeData.size());
-    }
+void Spec::test_waitAll_waitAny() {
+    QSemaphore first;
+    QSemaphore second;
 
-    {
-        QList<int> emptyList;
-        auto f = completed(emptyList);
-        QCOMPARE(f.isRunning(), false);
-        QCOMPARE(f.isFinished(), true);
-        QCOMPARE(f.isCanceled(), false);
-        QCOMPARE(f.resultCount(), 0);
-        QCOMPARE(f.results(), emptyList);
-        QCOMPARE(f.progressValue(), 0);
-        QCOMPARE(f.progressMinimum(), 0);
-        QCOMPARE(f.progressMaximum(), emptyList.size());
+    QList<QFuture<int>> futures;
+    futures << QtConcurrent::run([&]() {
+        first.acquire();
+        return 1;
+    });
+    futures << QtConcurrent::run([&]() {
+        second.acquire();
+        return 2;
+    });
 
-    }
-}
+    QCOMPARE(waitAny(futures, 20), -1);
+    QCOMPARE(waitAll(futures, 20), false);
 
-void Spec::test_waitForFinished() {
+    second.release();
+    QCOMPARE(waitAny(futures, 5000), 1);
+    QCOMPARE(waitAll(futures, 20), false);
+
+    first.release();
+    QCOMPARE(waitAll(futures, 5000), true);
+    QCOMPARE(waitAll(futures), true);
 
+    QCOMPARE(waitAny(QList<QFuture<int>>()), -1);
+    QCOMPARE(waitAll(QList<QFuture<int>>()), true);
 }
 
 void Spec::test_restarter() {
@@ -2493,6 +3704,492 @@ void Spec::test_restarter_qpromise_cancel_inner_loop() {
     QCOMPARE(secondIterations.loadRelaxed(), 5);
 }
 
+void Spec::test_restarter_debounce() {
+    // Restarts spread over several event loop turns start a single run once
+    // the input settles.
+    Restarter<int> restarter(QCoreApplication::instance());
+    restarter.setDebounce(100);
+
+    QAtomicInt runCount(0);
+    QAtomicInt deliveries(0);
+    restarter.onResult(this, [&](int) {
+        deliveries.fetchAndAddOrdered(1);
+    });
+
+    for (int i = 1; i <= 5; i++) {
+        restarter.restart([&runCount, i]() {
+            runCount.fetchAndAddOrdered(1);
+            return QtConcurrent::run([i]() {
+                return i;
+            });
+        });
+        Automator::wait(10);
+    }
+
+    QCOMPARE(runCount.loadRelaxed(), 0);
+
+    QVERIFY(waitUntil([&]() {
+        return restarter.future().isFinished();
+    }, 2000));
+    Test::tick();
+
+    QCOMPARE(runCount.loadRelaxed(), 1);
+    QCOMPARE(restarter.future().result(), 5);
+    QCOMPARE(deliveries.loadRelaxed(), 1);
+}
+
+void Spec::test_restarter_minInterval() {
+    Restarter<int> restarter(QCoreApplication::instance());
+    restarter.setMinInterval(200);
+
+    QElapsedTimer timer;
+    timer.start();
+    QList<qint64> startTimes;
+
+    auto run = [&]() {
+        restarter.restart([&]() {
+            startTimes << timer.elapsed();
+            return QtConcurrent::run([]() {
+                return 1;
+            });
+        });
+    };
+
+    run();
+    QVERIFY(waitUntil([&]() {
+        return restarter.future().isFinished();
+    }, 2000));
+
+    run();
+    QVERIFY(waitUntil([&]() {
+        return startTimes.size() == 2 && restarter.future().isFinished();
+    }, 2000));
+
+    QVERIFY(startTimes[1] - startTimes[0] >= 190);
+}
+
+void Spec::test_restarter_keyed_cache() {
+    Restarter<int> restarter(QCoreApplication::instance());
+
+    QAtomicInt runCount(0);
+    QList<int> received;
+    restarter.onResult(this, [&](int value) {
+        received << value;
+    });
+
+    auto runFor = [&](int value) {
+        return [&runCount, value]() {
+            runCount.fetchAndAddOrdered(1);
+            return QtConcurrent::run([value]() {
+                return value;
+            });
+        };
+    };
+
+    restarter.restart(QStringLiteral("a"), runFor(1));
+    QVERIFY(waitUntil(restarter.future(), 2000));
+
+    restarter.restart(QStringLiteral("b"), runFor(2));
+    QVERIFY(waitUntil(restarter.future(), 2000));
+    QCOMPARE(runCount.loadRelaxed(), 2);
+
+    // Cache hit: completed immediately without a worker
+    restarter.restart(QStringLiteral("a"), runFor(100));
+    QCOMPARE(restarter.future().isFinished(), true);
+    QCOMPARE(restarter.future().result(), 1);
+    QCOMPARE(runCount.loadRelaxed(), 2);
+
+    // A pending run is superseded by a cached result
+    restarter.restart(QStringLiteral("c"), runFor(3));
+    restarter.restart(QStringLiteral("b"), runFor(200));
+    QCOMPARE(restarter.future().isFinished(), true);
+    QCOMPARE(restarter.future().result(), 2);
+
+    Test::tick();
+    QCOMPARE(runCount.loadRelaxed(), 2);
+    QCOMPARE(received, QList<int>({1, 2, 1, 2}));
+
+    // Expired entries are recomputed
+    restarter.setCacheTtl(0);
+    restarter.clearCache();
+    restarter.restart(QStringLiteral("a"), runFor(1));
+    QVERIFY(waitUntil(restarter.future(), 2000));
+    restarter.restart(QStringLiteral("a"), runFor(1));
+    QVERIFY(waitUntil(restarter.future(), 2000));
+    QCOMPARE(runCount.loadRelaxed(), 4);
+}
+
+void Spec::test_restarter_metrics() {
+    Restarter<int> restarter(QCoreApplication::instance());
+
+    auto quick = []() {
+        return QtConcurrent::run([]() {
+            return 1;
+        });
+    };
+
+    // A burst is coalesced into a single run
+    restarter.restart(quick);
+    restarter.restart(quick);
+    restarter.restart(quick);
+    QVERIFY(waitUntil(restarter.future(), 2000));
+
+    RestarterMetrics metrics = restarter.metrics();
+    QCOMPARE(metrics.restartsRequested, 3);
+    QCOMPARE(metrics.runsStarted, 1);
+    QCOMPARE(metrics.runsCompleted, 1);
+    QCOMPARE(metrics.runsCanceled, 0);
+
+    QAtomicInt started(0);
+    restarter.restart([&]() {
+        return QtConcurrent::run([&](QPromise<int>& promise) {
+            started.storeRelease(1);
+            while (!promise.isCanceled()) {
+                QThread::msleep(1);
+            }
+        });
+    });
+    QVERIFY(waitUntil([&]() { return started.loadAcquire() == 1; }, 5000));
+    QThread::msleep(20);
+
+    restarter.restart(quick);
+    QVERIFY(waitUntil(restarter.future(), 2000));
+    Test::tick();
+
+    metrics = restarter.metrics();
+    QCOMPARE(metrics.restartsRequested, 5);
+    QCOMPARE(metrics.runsStarted, 3);
+    QCOMPARE(metrics.runsCompleted, 2);
+    QCOMPARE(metrics.runsCanceled, 1);
+    QVERIFY(metrics.canceledNSecs >= 20 * 1000 * 1000);
+    QVERIFY(metrics.wastedRatio() > 0);
+
+    restarter.resetMetrics();
+    QCOMPARE(restarter.metrics().runsStarted, 0);
+}
+
+void Spec::test_restarterMap() {
+    RestarterMap<QString, int> map(QCoreApplication::instance(), 2);
+    QCOMPARE(map.maxConcurrent(), 2);
+
+    QSemaphore gate;
+    QMutex mutex;
+    QStringList startOrder;
+
+    auto job = [&](const QString& key, int value) {
+        return [&, key, value]() {
+            {
+                QMutexLocker locker(&mutex);
+                startOrder << key;
+            }
+            return QtConcurrent::run([&gate, value]() {
+                gate.acquire();
+                return value;
+            });
+        };
+    };
+
+    QFuture<int> a = map.restart(QStringLiteral("a"), job(QStringLiteral("a"), 1));
+    QFuture<int> b = map.restart(QStringLiteral("b"), job(QStringLiteral("b"), 2));
+    QFuture<int> c = map.restart(QStringLiteral("c"), job(QStringLiteral("c"), 3));
+    QFuture<int> d = map.restart(QStringLiteral("d"), job(QStringLiteral("d"), 4));
+
+    // Coalesced with the previous request of the same key
+    QFuture<int> a2 = map.restart(QStringLiteral("a"), job(QStringLiteral("a"), 10));
+
+    QCOMPARE(map.size(), 4);
+    QCOMPARE(map.queuedCount(), 4);
+
+    Test::tick();
+
+    // The most recently requested keys start first
+    QCOMPARE(map.runningCount(), 2);
+    QCOMPARE(map.queuedCount(), 2);
+    QCOMPARE(startOrder, QStringList({"a", "d"}));
+
+    gate.release(4);
+    QVERIFY(waitUntil([&]() {
+        return a.isFinished() && b.isFinished() && c.isFinished() && d.isFinished();
+    }, 2000));
+
+    QCOMPARE(startOrder, QStringList({"a", "d", "c", "b"}));
+    QCOMPARE(a2.result(), 10);
+    QCOMPARE(a.result(), 10);
+    QCOMPARE(b.result(), 2);
+    QCOMPARE(d.result(), 4);
+    QCOMPARE(map.runningCount(), 0);
+
+    // Canceling a queued key
+    map.setMaxConcurrent(1);
+    QFuture<int> e = map.restart(QStringLiteral("e"), job(QStringLiteral("e"), 5));
+    QFuture<int> f = map.restart(QStringLiteral("f"), job(QStringLiteral("f"), 6));
+    map.cancel(QStringLiteral("e"));
+    QCOMPARE(e.isCanceled(), true);
+    QCOMPARE(map.queuedCount(), 1);
+
+    gate.release(1);
+    QVERIFY(waitUntil(f, 2000));
+    QCOMPARE(f.result(), 6);
+
+    // A canceled run holds its slot until its worker returns
+    QFuture<int> g = map.restart(QStringLiteral("g"), job(QStringLiteral("g"), 7));
+    QVERIFY(waitUntil([&]() { return map.runningCount() == 1; }, 2000));
+    map.restart(QStringLiteral("g"), job(QStringLiteral("g"), 8));
+
+    Test::tick();
+    Test::tick();
+    QCOMPARE(map.runningCount(), 1);
+    {
+        QMutexLocker locker(&mutex);
+        QCOMPARE(startOrder.count(QStringLiteral("g")), 1);
+    }
+
+    gate.release(2);
+    QVERIFY(waitUntil(g, 2000));
+    QCOMPARE(g.result(), 8);
+    QVERIFY(waitUntil([&]() { return map.runningCount() == 0; }, 2000));
+
+    // Idle keys are evicted
+    map.setIdleTimeout(10);
+    QVERIFY(waitUntil([&]() { return map.size() == 0; }, 2000));
+    QCOMPARE(map.future(QStringLiteral("a")).isCanceled(), true);
+
+    {
+        // The runs canceled with the context hold their slots until their workers return
+        auto context = new QObject();
+        RestarterMap<QString, int> scoped(context, 1);
+
+        QFuture<int> h = scoped.restart(QStringLiteral("h"), job(QStringLiteral("h"), 9));
+        QVERIFY(waitUntil([&]() { return scoped.runningCount() == 1; }, 2000));
+
+        delete context;
+        QCOMPARE(h.isCanceled(), true);
+
+        QFuture<int> i = scoped.restart(QStringLiteral("i"), job(QStringLiteral("i"), 10));
+        QFuture<int> j = scoped.restart(QStringLiteral("j"), job(QStringLiteral("j"), 11));
+
+        Test::tick();
+        Test::tick();
+        QCOMPARE(scoped.runningCount(), 1);
+        {
+            QMutexLocker locker(&mutex);
+            QCOMPARE(startOrder.contains(QStringLiteral("j")), false);
+        }
+
+        gate.release(1);
+        QVERIFY(waitUntil([&]() {
+            QMutexLocker locker(&mutex);
+            return startOrder.contains(QStringLiteral("j"));
+        }, 2000));
+
+        Test::tick();
+        Test::tick();
+        QCOMPARE(scoped.runningCount(), 1);
+        {
+            QMutexLocker locker(&mutex);
+            QCOMPARE(startOrder.contains(QStringLiteral("i")), false);
+        }
+
+        gate.release(2);
+        QVERIFY(waitUntil([&]() {
+            return i.isFinished() && j.isFinished();
+        }, 2000));
+        QCOMPARE(i.result(), 10);
+        QCOMPARE(j.result(), 11);
+    }
+}
+
+void Spec::test_restarter_preemption() {
+    Restarter<int> restarter(QCoreApplication::instance());
+    QCOMPARE(restarter.preemptionPolicy(), PreemptionPolicy::CancelImmediately);
+
+    QList<int> received;
+    restarter.onResult(this, [&](int value) {
+        received << value;
+    });
+
+    QSemaphore gate;
+    QAtomicInt reported(0);
+    QAtomicInt canceled(0);
+
+    // Reports `progress` of 10, then waits for the gate
+    auto slowJob = [&](int progress, int value) {
+        return [&, progress, value]() {
+            return QtConcurrent::run([&, progress, value](QPromise<int>& promise) {
+                promise.setProgressRange(0, 10);
+                promise.setProgressValue(progress);
+                reported.storeRelease(1);
+                while (!gate.tryAcquire(1, 1)) {
+                    if (promise.isCanceled()) {
+                        canceled.storeRelease(1);
+                        return;
+                    }
+                }
+                promise.addResult(value);
+            });
+        };
+    };
+
+    auto quickJob = [](int value) {
+        return [value]() {
+            return QtConcurrent::run([value]() {
+                return value;
+            });
+        };
+    };
+
+    {
+        // The running job is nearly done, so it delivers its result first
+        restarter.setPreemptionPolicy(PreemptionPolicy::FinishIfNearlyDone, 0.8);
+        restarter.restart(slowJob(9, 1));
+        QVERIFY(waitUntil([&]() { return reported.loadAcquire() == 1; }, 2000));
+        QFuture<int> first = restarter.future();
+
+        restarter.restart(quickJob(2));
+        Test::tick();
+        QCOMPARE(first.isFinished(), false);
+
+        gate.release(1);
+        QVERIFY(waitUntil(first, 2000));
+        QCOMPARE(first.result(), 1);
+
+        QVERIFY(waitUntil([&]() { return restarter.future().isFinished(); }, 2000));
+        QCOMPARE(restarter.future().result(), 2);
+        QCOMPARE(canceled.loadAcquire(), 0);
+    }
+
+    {
+        // Below the threshold the running job is canceled as before
+        reported.storeRelease(0);
+        restarter.restart(slowJob(2, 3));
+        QVERIFY(waitUntil([&]() { return reported.loadAcquire() == 1; }, 2000));
+
+        restarter.restart(quickJob(4));
+        QVERIFY(waitUntil([&]() { return restarter.future().isFinished(); }, 2000));
+        QCOMPARE(restarter.future().result(), 4);
+        QVERIFY(waitUntil([&]() { return canceled.loadAcquire() == 1; }, 2000));
+    }
+
+    {
+        // Both run, and only the newest result is delivered
+        restarter.setPreemptionPolicy(PreemptionPolicy::RunBothKeepNewest);
+        reported.storeRelease(0);
+        canceled.storeRelease(0);
+        restarter.restart(slowJob(1, 5));
+        QVERIFY(waitUntil([&]() { return reported.loadAcquire() == 1; }, 2000));
+        QFuture<int> future = restarter.future();
+
+        restarter.restart(quickJob(6));
+        QVERIFY(waitUntil(future, 2000));
+        QCOMPARE(future.result(), 6);
+
+        // The older run finishes later and is counted as wasted work
+        gate.release(1);
+        QTRY_COMPARE(restarter.metrics().runsCanceled, 2);
+        QCOMPARE(canceled.loadAcquire(), 0);
+        QCOMPARE(restarter.future().result(), 6);
+    }
+
+    Test::tick();
+    QCOMPARE(received, QList<int>({1, 2, 4, 6}));
+
+    {
+        // A burst of restarts keeps at most two runs in flight
+        QList<QFuture<int>> runs;
+        auto gatedJob = [&](int value) {
+            return [&, value]() {
+                QFuture<int> run = QtConcurrent::run([&, value](QPromise<int>& promise) {
+                    while (!gate.tryAcquire(1, 1)) {
+                        if (promise.isCanceled()) {
+                            return;
+                        }
+                    }
+                    promise.addResult(value);
+                });
+                runs << run;
+                return run;
+            };
+        };
+
+        auto inFlight = [&]() {
+            int count = 0;
+            for (const QFuture<int>& run : runs) {
+                if (run.isRunning() && !run.isCanceled()) {
+                    count++;
+                }
+            }
+            return count;
+        };
+
+        for (int i = 0 ; i < 8 ; i++) {
+            restarter.restart(gatedJob(10 + i));
+            QTRY_COMPARE(runs.size(), i + 1);
+            QVERIFY(inFlight() <= 2);
+        }
+        QCOMPARE(inFlight(), 2);
+
+        // The canceled runs stop without waiting for the gate
+        QTRY_VERIFY(std::all_of(runs.begin(), runs.end() - 2, [](const QFuture<int>& run) {
+            return run.isFinished();
+        }));
+
+        gate.release(2);
+        QVERIFY(waitUntil(restarter.future(), 2000));
+        QCOMPARE(restarter.future().result(), 17);
+
+        Test::tick();
+        QCOMPARE(received.last(), 17);
+    }
+}
+
+void Spec::test_restarter_restart_state() {
+    typedef Restarter<int>::RestartState RestartState;
+    Restarter<int> restarter(QCoreApplication::instance());
+
+    QAtomicInt published(0);
+    bool firstHasState = true;
+
+    // The first run publishes a checkpoint and is canceled before it finishes
+    restarter.restart([&](const RestartState& state) {
+        firstHasState = state.previous().resultCount() > 0 || state.hasCheckpoint();
+        return QtConcurrent::run([&, state](QPromise<int>& promise) {
+            state.publish(5);
+            published.storeRelease(1);
+            while (!promise.isCanceled()) {
+                QThread::msleep(1);
+            }
+        });
+    });
+    QVERIFY(waitUntil([&]() { return published.loadAcquire() == 1; }, 2000));
+    QCOMPARE(firstHasState, false);
+
+    int handed = 0;
+    restarter.restart([&](const RestartState& state) {
+        handed = state.checkpoint<int>();
+        return QtConcurrent::run([handed]() {
+            return handed + 1;
+        });
+    });
+    QVERIFY(waitUntil(restarter.future(), 2000));
+    QCOMPARE(handed, 5);
+    QCOMPARE(restarter.future().result(), 6);
+
+    // A completed run clears the checkpoint and becomes the previous result
+    int previous = 0;
+    bool hasCheckpoint = true;
+    restarter.restart([&](const RestartState& state) {
+        previous = state.previous().result();
+        hasCheckpoint = state.hasCheckpoint();
+        return QtConcurrent::run([previous]() {
+            return previous * 2;
+        });
+    });
+    QVERIFY(waitUntil(restarter.future(), 2000));
+    QCOMPARE(previous, 6);
+    QCOMPARE(hasCheckpoint, false);
+    QCOMPARE(restarter.future().result(), 12);
+}
+
 void Spec::test_subscribe_qpromise_cancel_inner_loop() {
     QAtomicInt iterations(0);
     QAtomicInt started(0);
@@ -8,9 +8,14 @@ public:
     inline SignalProxy(QObject* parent = nullptr) : QObject(parent) {
     }
 
+    inline int proxy1Receivers() const {
+        return receivers(SIGNAL(proxy1(int)));
+    }
+
 signals:
     void proxy0();
     void proxy1(int);
+    void proxy2(int, const QString&);
 };
 
 class Spec : public QObject
@@ -40,6 +45,8 @@ private slots:
 
     void test_private_DeferredFuture();
 
+    void test_private_TimerService();
+
     void test_private_run();
 
     void test_observe_future_future();
@@ -51,14 +58,37 @@ private slots:
 
     void test_Observable_context_return_future();
 
+    void test_Observable_priority();
+
+    void test_Observable_run();
+
+    void test_Observable_timeout();
+
+    void test_WorkStealingExecutor();
+
     void test_Observable_signal();
+    void test_Observable_signal_lazy();
+
+    void test_Observable_signal_in_thread();
     void test_Observable_signal_with_argument();
 
+    void test_Observable_signal_with_arguments();
+
+    void test_Observable_signal_connection_policy();
+
     void test_Observable_signal_by_signature();
 
+    void test_Observable_signal_metadata_cache();
+
 
     void test_Observable_signal_destroyed();
 
+    void test_Observable_signal_stream();
+
+    void test_Observable_signal_when();
+
+    void test_Observable_signal_operators();
+
     void test_Observable_subscribe();
 
     void test_Observable_subscribe_in_thread();
@@ -92,12 +122,18 @@ private slots:
     void test_Deferred_complete_future_future();
     void test_Deferred_complete_list();
     void test_Deferred_complete_empty_list();
+    void test_Deferred_complete_large_list();
+    void test_Deferred_reportResult();
     void test_Deferred_cancel_future();
 
     void test_Deferred_future_cancel();
 
+    void test_Deferred_cancelAfter();
+
     void test_Deferred_across_thread();
     void test_Deferred_inherit();
+    void test_Deferred_lazy();
+    void test_Promise();
     void test_Deferred_track();
     void test_Deferred_track_started();
 
@@ -111,13 +147,28 @@ private slots:
 
     void test_Combinator_progressValue();
 
+    void test_Combinator_onEach();
+
+    void test_Combinator_stream();
+
+    void test_Combinator_timeout();
+
     void test_alive();
 
     void test_completed();
+
+    void test_delay();
+
+    void test_interval();
     void test_Combinator_add_to_already_finished_finished();
     void test_observe_future_future_completed();
 
+    void test_mapConcurrent();
+    void test_mapConcurrent_cancel();
+
     void test_waitForFinished();
+    void test_waitForFinished_blocking();
+    void test_waitAll_waitAny();
     void test_restarter();
     void test_restarter_waitForFinished_snapshot();
     void test_restarter_destroy_before_context();
@@ -142,6 +193,13 @@ private slots:
     void test_restarter_onResult_context_destroyed();
     void test_restarter_onResult_composes_with_onFutureChanged();
     void test_restarter_onResult_rapid_fire_delivers_latest_once();
+    void test_restarter_debounce();
+    void test_restarter_minInterval();
+    void test_restarter_keyed_cache();
+    void test_restarter_metrics();
+    void test_restarterMap();
+    void test_restarter_preemption();
+    void test_restarter_restart_state();
     void test_subscribe_qpromise_cancel_inner_loop();
     void test_context_qpromise_cancel_inner_loop();
 